@@ -0,0 +1,993 @@
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+
+#include "../buffers/buffers.hpp"
+#include "../client.hpp"
+#include "../frame_mailbox.hpp"
+#include "../messages/gui.hpp"
+#include "../messages/server.hpp"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using bench_clock = std::chrono::steady_clock;
+
+// Heap allocations made so far, counted to show what decoding allocates.
+std::atomic<size_t> allocations{0};
+
+[[gnu::noinline]] void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *block = malloc(size == 0 ? 1 : size))
+        return block;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *block) noexcept {
+    free(block);
+}
+
+[[gnu::noinline]] void operator delete(void *block, size_t) noexcept {
+    free(block);
+}
+
+template <typename T>
+std::string encode(const T &val) {
+    MemoryOutBuffer buffer;
+    buffer << val;
+    return buffer.take();
+}
+
+// Hands out the same bytes over and over, as whole datagrams or as an endless stream.
+class MemoryInTransport : public InTransport {
+public:
+    MemoryInTransport(std::string bytes) : bytes(std::move(bytes)) {}
+
+    virtual size_t receive(void *dest, size_t n) {
+        size_t length = std::min(n, bytes.size() - offset);
+        memcpy(dest, bytes.data() + offset, length);
+        offset = (offset + length) % bytes.size();
+        return length;
+    }
+
+    virtual size_t get_memory_usage() { return sizeof(*this) + bytes.capacity(); }
+
+private:
+    std::string bytes;
+    size_t offset = 0;
+};
+
+void report(const std::string &name, size_t iterations, bench_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << std::left << std::setw(44) << name << std::right
+              << std::setw(12) << (size_t) ((double) iterations / seconds) << " ops/s"
+              << std::setw(12) << std::fixed << std::setprecision(0)
+              << seconds * 1e9 / (double) iterations << " ns/op\n";
+}
+
+// Pins the thread to the CPU, if the machine has it.
+bool pin_to_cpu(std::thread &thread, unsigned cpu) {
+    if (cpu >= std::thread::hardware_concurrency())
+        return false;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) == 0;
+}
+
+uint16_t free_udp_port(boost::asio::io_context &io_context) {
+    udp::socket socket(io_context, udp::endpoint(udp::v6(), 0));
+    return socket.local_endpoint().port();
+}
+
+EndPoint loopback(uint16_t port) {
+    return EndPoint("[::1]:" + std::to_string(port));
+}
+
+Hello bench_settings(Position::coord_t size = 100) {
+    return Hello("bench", 2, size, size, 60000, 5, 10);
+}
+
+Turn bench_turn(game_length_t turn) {
+    std::vector<Event> events;
+    for (Player::id_t id = 0; id < 2; id++) {
+        events.push_back(PlayerMoved(id, Position((Position::coord_t) (turn % 100), id)));
+    }
+    events.push_back(BlockPlaced(Position((Position::coord_t) (turn % 100), 50)));
+    return Turn(turn, events);
+}
+
+/* A recorded game on a block-heavy map: the first turn fills a third of the board
+ * with blocks, later ones move robots, place bombs and blow up blocks around them. */
+std::string record_game(const Hello &settings, game_length_t turns) {
+    std::mt19937 random(1234);
+    auto random_position = [&random, &settings]() {
+        return Position((Position::coord_t) (random() % settings.get_size_x()),
+                        (Position::coord_t) (random() % settings.get_size_y()));
+    };
+    std::set<Position> blocks;
+    std::map<game_length_t, std::pair<Bomb::id_t, Position>> exploding;
+    Bomb::id_t next_bomb = 0;
+    std::string recorded;
+    for (game_length_t turn = 0; turn < turns; turn++) {
+        std::vector<Event> events;
+        if (turn == 0) {
+            while (blocks.size() < (size_t) settings.get_size_x() * settings.get_size_y() / 3) {
+                Position position = random_position();
+                if (blocks.insert(position).second) {
+                    events.push_back(BlockPlaced(position));
+                }
+            }
+        }
+        auto bomb = exploding.find(turn);
+        if (bomb != exploding.end()) {
+            BombExploded::blocks_t destroyed;
+            for (const Position &block : blocks) {
+                Position center = bomb->second.second;
+                if (destroyed.size() < 4 && (block.get_x() == center.get_x() || block.get_y() == center.get_y())
+                    && std::abs(block.get_x() - center.get_x()) + std::abs(block.get_y() - center.get_y()) <= 3) {
+                    destroyed.push_back(block);
+                }
+            }
+            for (const Position &block : destroyed) {
+                blocks.erase(block);
+            }
+            events.push_back(BombExploded(bomb->second.first, {}, destroyed));
+            exploding.erase(bomb);
+        }
+        if (turn % 2 == 0) {
+            Position position = random_position();
+            events.push_back(BombPlaced(next_bomb, position));
+            exploding[(game_length_t) (turn + settings.get_bomb_timer())] = {next_bomb++, position};
+        }
+        for (Player::id_t id = 0; id < 2; id++) {
+            events.push_back(PlayerMoved(id, random_position()));
+        }
+        recorded += encode(ServerMessage(Turn(turn, events)));
+    }
+    return recorded;
+}
+
+// Game frame with the given number of blocks and a bomb for every ten of them.
+DrawMessage bench_game(size_t blocks) {
+    DrawMessage game_state = Lobby(bench_settings(200)).start_game(GameStarted({
+        {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+    std::vector<Event> events;
+    for (size_t i = 0; i < blocks; i++) {
+        Position position((Position::coord_t) (i % 100), (Position::coord_t) (i / 100));
+        events.push_back(BlockPlaced(position));
+        if (i % 10 == 0) {
+            events.push_back(BombPlaced((Bomb::id_t) i, position));
+        }
+    }
+    events.push_back(PlayerMoved(0, Position(1, 1)));
+    events.push_back(PlayerMoved(1, Position(2, 2)));
+    std::get<Game>(game_state).process_turn(Turn(0, events));
+    return game_state;
+}
+
+void bench_frame_encoding(size_t iterations) {
+    for (size_t blocks : {100, 1000, 10000, 40000}) {
+        DrawMessage game_state = bench_game(blocks);
+        if (encode(game_state).size() != encoded_size(game_state)) {
+            throw std::runtime_error("Frame size mismatch.");
+        }
+        MemoryOutBuffer buffer;
+        size_t rounds = iterations * 100 / blocks;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < rounds; i++) {
+            buffer << game_state;
+            buffer.discard();
+        }
+        report("encode frame with " + std::to_string(blocks) + " blocks", rounds, bench_clock::now() - start);
+    }
+}
+
+// Frames of a full lobby and of a game among its players, where the names and addresses make up most of the bytes.
+void bench_crowded_frame_encoding(size_t iterations) {
+    Lobby lobby(bench_settings());
+    PlayerTable<Player> players;
+    for (Player::id_t id = 0; id < 25; id++) {
+        Player player("Player number " + std::to_string(id), "[2001:db8::" + std::to_string(id) + "]:40001");
+        lobby.add_player(AcceptedPlayer(id, Player(player)));
+        players[id] = player;
+    }
+    std::vector<Event> events;
+    for (Player::id_t id = 0; id < 25; id++) {
+        events.push_back(PlayerMoved(id, Position(id, id)));
+    }
+    DrawMessage game_state = Lobby(bench_settings()).start_game(GameStarted(std::move(players)));
+    std::get<Game>(game_state).process_turn(Turn(0, events));
+
+    for (DrawMessage frame : {DrawMessage(lobby), game_state}) {
+        MemoryOutBuffer buffer;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            buffer << frame;
+            buffer.discard();
+        }
+        report(std::string("encode ") + (frame.index() == 0 ? "lobby" : "game") + " frame with 25 players",
+               iterations, bench_clock::now() - start);
+    }
+}
+
+// Byte order conversion of the Positions of a frame, a word at a time and in bulk.
+void bench_byteswap(size_t iterations) {
+    for (size_t positions : {100, 1000, 10000}) {
+        std::vector<char> src(positions * wire_size<Position>()), dest(src.size());
+        for (size_t i = 0; i < src.size(); i++) {
+            src[i] = (char) i;
+        }
+        size_t rounds = iterations * 100 / positions;
+        size_t words = src.size() / 2;
+        for (bool bulk : {false, true}) {
+            bench_clock::time_point start = bench_clock::now();
+            for (size_t i = 0; i < rounds; i++) {
+                if (bulk) {
+                    byteswap_words<2>(dest.data(), src.data(), words);
+                } else {
+                    byteswap_words_scalar<2>(dest.data(), src.data(), words);
+                }
+                asm volatile("" : : "r"(dest.data()) : "memory");
+            }
+            report(std::string(bulk ? "bulk" : "scalar") + " byteswap of " + std::to_string(positions) + " positions",
+                   rounds, bench_clock::now() - start);
+        }
+    }
+}
+
+void bench_position_list_decoding(size_t iterations) {
+    for (size_t positions : {100, 1000, 10000}) {
+        std::list<Position> list;
+        for (size_t i = 0; i < positions; i++) {
+            list.push_back(Position((Position::coord_t) i, (Position::coord_t) (i * 7)));
+        }
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        MemoryInTransport transport(encode(list));
+        TCPInBuffer buffer(socket, transport);
+        size_t rounds = iterations * 100 / positions;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < rounds; i++) {
+            if (decode(buffer, list) != DecodeError::None || list.size() != positions) {
+                throw std::runtime_error("Positions not decoded.");
+            }
+        }
+        report("decode list of " + std::to_string(positions) + " positions", rounds, bench_clock::now() - start);
+    }
+}
+
+/* Client-like loopback setup: a fake server and GUI talk to a TCPBuffer and a
+ * UDPBuffer, each direction handled by its own thread like in Client::run.
+ * Messages for the server are sent on the ring of the thread receiving GUI inputs,
+ * or with queued, by a sender thread on a ring of its own, as Client does. */
+class LoopbackBench {
+public:
+    LoopbackBench(bool io_uring, bool queued = false)
+    : queued(queued), acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0)),
+      gui(io_context, udp::endpoint(boost::asio::ip::address_v6::loopback(), 0)),
+      client_port(free_udp_port(io_context)),
+      gui_ring(io_uring ? Uring::create() : nullptr), server_ring(io_uring ? Uring::create() : nullptr),
+      send_ring(io_uring && queued ? Uring::create() : nullptr),
+      server_buffer(io_context, loopback(acceptor.local_endpoint().port()), server_ring.get(),
+                    queued ? send_ring.get() : gui_ring.get()),
+      server(acceptor.accept()),
+      gui_buffer(io_context, client_port, {loopback(gui.local_endpoint().port())}, gui_ring.get(), server_ring.get()) {}
+
+    bool has_rings() { return gui_ring && server_ring; }
+
+    // GUI input datagram in, Move written to the server directly or by the send queue's thread.
+    void input_to_move(const std::string &name, size_t iterations) {
+        std::thread sender([this]() {
+            if (queued)
+                server_buffer.write_send_queue();
+        });
+        std::thread client([this, iterations]() {
+            InputMessage input_message;
+            for (size_t i = 0; i < iterations; i++) {
+                gui_buffer >> input_message;
+                server_buffer << ClientMessage(Move(Direction::Up));
+                if (queued)
+                    server_buffer.queue_send();
+                else
+                    server_buffer.send();
+            }
+            if (gui_ring)
+                gui_ring->submit();
+        });
+
+        udp::endpoint client_endpoint(boost::asio::ip::address_v6::loopback(), client_port);
+        std::string input = encode(InputMessage(Move(Direction::Up)));
+        char reply[2];
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            gui.send_to(boost::asio::buffer(input), client_endpoint);
+            boost::asio::read(server, boost::asio::buffer(reply));
+        }
+        report(name, iterations, bench_clock::now() - start);
+        client.join();
+        if (queued)
+            server_buffer.close_send_queue();
+        sender.join();
+    }
+
+    /* GUI inputs handled while the server reads nothing. A blocking write would stall
+     * once the socket buffers fill up, the send queue drops messages instead. Queued only. */
+    void inputs_to_stalled_server(const std::string &name, size_t iterations) {
+        std::thread sender([this]() { server_buffer.write_send_queue(); });
+        const ClientMessage join = Join(std::string(255, 'x'));
+        size_t queued = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            server_buffer << join;
+            queued += server_buffer.queue_send();
+        }
+        bench_clock::duration elapsed = bench_clock::now() - start;
+
+        std::vector<char> received(queued * encode(join).size());
+        boost::asio::read(server, boost::asio::buffer(received));
+        server_buffer.close_send_queue();
+        sender.join();
+        report(name + ", " + std::to_string(iterations - queued) + " dropped", iterations, elapsed);
+    }
+
+    // Bursts of GUI inputs decoded as a batch and forwarded with one write.
+    void input_burst_to_moves(const std::string &name, size_t iterations, size_t burst) {
+        std::thread client([this, iterations]() {
+            std::vector<InputMessage> input_messages;
+            const ClientMessage move = Move(Direction::Up);
+            for (size_t received = 0; received < iterations;) {
+                gui_buffer.receive_batch(input_messages);
+                for (size_t i = 0; i < input_messages.size(); i++) {
+                    server_buffer << move;
+                }
+                server_buffer.send();
+                received += input_messages.size();
+            }
+            if (gui_ring)
+                gui_ring->submit();
+        });
+
+        udp::endpoint client_endpoint(boost::asio::ip::address_v6::loopback(), client_port);
+        std::string input = encode(InputMessage(Move(Direction::Up)));
+        std::vector<char> replies(2 * burst);
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i += burst) {
+            for (size_t j = 0; j < burst; j++) {
+                gui.send_to(boost::asio::buffer(input), client_endpoint);
+            }
+            boost::asio::read(server, boost::asio::buffer(replies));
+        }
+        report(name, iterations, bench_clock::now() - start);
+        client.join();
+    }
+
+    // Turn written by the server in, Game frame sent to the GUI.
+    void turn_to_frame(const std::string &name, size_t iterations) {
+        std::thread client([this, iterations]() {
+            DrawMessage game_state = Lobby(bench_settings()).start_game(GameStarted({
+                {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+            for (size_t i = 0; i < iterations; i++) {
+                ServerMessage message;
+                server_buffer >> message;
+                Game &game = std::get<Game>(game_state);
+                game.process_turn(std::move(std::get<Turn>(message)));
+                gui_buffer << game_state;
+                gui_buffer.send();
+                game.next_turn();
+            }
+            if (server_ring)
+                server_ring->submit();
+        });
+
+        std::vector<std::string> turns;
+        for (size_t i = 0; i < iterations; i++) {
+            turns.push_back(encode(ServerMessage(bench_turn((game_length_t) i))));
+        }
+        char frame[65536];
+        bench_clock::time_point start = bench_clock::now();
+        for (const std::string &turn : turns) {
+            boost::asio::write(server, boost::asio::buffer(turn));
+            gui.receive(boost::asio::buffer(frame));
+        }
+        report(name, iterations, bench_clock::now() - start);
+        client.join();
+    }
+
+    /* Bursts of turns written by the server at once, as after a stall, until the GUI
+     * gets the frame of the newest one. With catch_up set, the client applies every
+     * turn already received before drawing, like Client does, otherwise it draws each. */
+    void backlog_to_frame(const std::string &name, size_t iterations, size_t burst, bool catch_up) {
+        size_t turns = iterations / burst * burst;
+        std::thread client([this, turns, catch_up]() {
+            DrawMessage game_state = Lobby(bench_settings()).start_game(GameStarted({
+                {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+            Game &game = std::get<Game>(game_state);
+            bool frame_pending = false;
+            auto flush = [&]() {
+                gui_buffer << game_state;
+                gui_buffer.send();
+                game.next_turn();
+                frame_pending = false;
+            };
+            for (size_t i = 0; i < turns; i++) {
+                ServerMessageView message;
+                if (!catch_up || server_buffer.try_receive(message) == DecodeError::Incomplete) {
+                    if (frame_pending)
+                        flush();
+                    server_buffer >> message;
+                }
+                if (frame_pending)
+                    game.next_turn();
+                game.process_turn(std::get<TurnView>(message));
+                frame_pending = true;
+                if (!catch_up)
+                    flush();
+            }
+            if (frame_pending)
+                flush();
+            if (server_ring)
+                server_ring->submit();
+        });
+
+        std::vector<std::string> bursts;
+        for (size_t i = 0; i < turns; i++) {
+            if (i % burst == 0)
+                bursts.emplace_back();
+            bursts.back() += encode(ServerMessage(bench_turn((game_length_t) i)));
+        }
+        const size_t turn_offset = 1 + encoded_size(bench_settings().get_server_name()) + 3 * sizeof(uint16_t);
+        char frame[65536];
+        game_length_t last = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (const std::string &turns_burst : bursts) {
+            boost::asio::write(server, boost::asio::buffer(turns_burst));
+            last = (game_length_t) (last + burst);
+            game_length_t drawn;
+            do {
+                gui.receive(boost::asio::buffer(frame));
+                load(frame + turn_offset, drawn);
+            } while ((game_length_t) (drawn + 1) != last);
+        }
+        report(name, bursts.size(), bench_clock::now() - start);
+        client.join();
+    }
+
+    /* Turns of a recorded game written as fast as the client takes them, until the GUI
+     * gets the frame of the last one. With pipelined set, frames are handed to a sender
+     * thread through a FrameMailbox like in Client::run, otherwise sent in between turns. */
+    void turn_flood_to_frame(const std::string &name, bool pipelined) {
+        const game_length_t turns = 1000;
+        std::string recorded = record_game(bench_settings(), turns);
+        std::thread client([this, pipelined]() {
+            DrawMessage game_state = Lobby(bench_settings()).start_game(GameStarted({
+                {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+            Game &game = std::get<Game>(game_state);
+            MemoryOutBuffer frame_encoder;
+            FrameMailbox frames;
+            std::thread sender([this, &frames]() {
+                std::string frame;
+                while (frames.take(frame)) {
+                    gui_buffer.send(frame);
+                }
+            });
+            for (game_length_t turn = 0; turn < turns; turn++) {
+                ServerMessageView message;
+                server_buffer >> message;
+                game.process_turn(std::get<TurnView>(message));
+                if (pipelined) {
+                    frame_encoder << game_state;
+                    frame_encoder.take(frames.back());
+                    frames.publish();
+                } else {
+                    gui_buffer << game_state;
+                    gui_buffer.send();
+                }
+                game.next_turn();
+            }
+            frames.close();
+            sender.join();
+            if (server_ring)
+                server_ring->submit();
+        });
+
+        const size_t turn_offset = 1 + encoded_size(bench_settings().get_server_name()) + 3 * sizeof(uint16_t);
+        std::vector<char> frame(65536);
+        bench_clock::time_point start = bench_clock::now();
+        std::thread server_writer([this, &recorded]() {
+            boost::asio::write(server, boost::asio::buffer(recorded));
+        });
+        game_length_t drawn;
+        do {
+            gui.receive(boost::asio::buffer(frame));
+            load(frame.data() + turn_offset, drawn);
+        } while (drawn + 1 != turns);
+        report(name, turns, bench_clock::now() - start);
+        server_writer.join();
+        client.join();
+    }
+
+    /* GUI inputs forwarded while the other thread applies the turns of a recorded game
+     * and sends their frames, one every TURN_INTERVAL. Checking the phase under a lock
+     * held across every turn, the way the client did before publishing it, and with the
+     * atomic alternate for a few rounds. The median of each is reported, as one round
+     * on a shared CPU is mostly scheduler noise. With enough CPUs, the two client
+     * threads each get one of their own. */
+    void input_during_turns(const std::string &name, size_t iterations, size_t rounds) {
+        std::vector<size_t> p99s[2], means[2];
+        bench_clock::duration elapsed[2]{};
+        bool pinned = false;
+        for (size_t round = 0; round < rounds; round++) {
+            for (bool locked : {true, false}) {
+                std::vector<bench_clock::duration> latencies;
+                bench_clock::time_point start = bench_clock::now();
+                pinned = inputs_during_turns(iterations, locked, latencies);
+                elapsed[locked] += bench_clock::now() - start;
+                std::sort(latencies.begin(), latencies.end());
+                p99s[locked].push_back(to_us(latencies[latencies.size() * 99 / 100]));
+                bench_clock::duration total{};
+                for (bench_clock::duration latency : latencies)
+                    total += latency;
+                means[locked].push_back(to_us(total / latencies.size()));
+            }
+        }
+        for (bool locked : {true, false}) {
+            report(name + (locked ? ", locked" : ", atomic") + ", p99 " + std::to_string(median(p99s[locked]))
+                   + " us, mean " + std::to_string(median(means[locked])) + " us" + (pinned ? "" : ", unpinned"),
+                   iterations * rounds, elapsed[locked]);
+        }
+    }
+
+private:
+    static constexpr bench_clock::duration TURN_INTERVAL = std::chrono::microseconds(250);
+
+    // One round of input_during_turns(). Returns whether the threads were pinned.
+    bool inputs_during_turns(size_t iterations, bool locked, std::vector<bench_clock::duration> &latencies) {
+        std::shared_mutex game_state_mutex;
+        DrawMessage game_state = Lobby(bench_settings());
+        std::atomic<bool> in_lobby = true;
+        std::atomic<bool> stop = false;
+        std::thread turns([&]() {
+            MemoryInBuffer recorded(record_game(bench_settings(), 1000));
+            ServerMessageView message;
+            bench_clock::time_point next_turn = bench_clock::now();
+            while (!stop.load()) {
+                {
+                    std::unique_lock lock(game_state_mutex, std::defer_lock);
+                    if (locked)
+                        lock.lock();
+                    if (std::holds_alternative<Lobby>(game_state)) {
+                        recorded.restart();
+                        game_state = std::get<Lobby>(game_state).start_game(GameStarted({
+                            {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+                        in_lobby.store(false, std::memory_order_release);
+                    }
+                    Game &game = std::get<Game>(game_state);
+                    if (decode(recorded, message) != DecodeError::None) {
+                        throw std::runtime_error("Turn not decoded.");
+                    }
+                    game.process_turn(std::get<TurnView>(message));
+                    gui_buffer << game_state;
+                    gui_buffer.send();
+                    game.next_turn();
+                    if (recorded.get_left() == 0) {
+                        game_state = game.end_game();
+                        in_lobby.store(true, std::memory_order_release);
+                    }
+                }
+                if (server_ring)
+                    server_ring->submit();
+                next_turn += TURN_INTERVAL;
+                std::this_thread::sleep_until(next_turn);
+            }
+        });
+
+        std::thread client([&]() {
+            InputMessage input_message;
+            for (size_t i = 0; i < iterations; i++) {
+                gui_buffer >> input_message;
+                bool lobby;
+                if (locked) {
+                    std::shared_lock lock(game_state_mutex);
+                    lobby = std::holds_alternative<Lobby>(game_state);
+                } else {
+                    lobby = in_lobby.load(std::memory_order_acquire);
+                }
+                server_buffer << ClientMessage(Move(lobby ? Direction::Down : Direction::Up));
+                server_buffer.send();
+            }
+            if (gui_ring)
+                gui_ring->submit();
+        });
+        bool pinned = pin_to_cpu(turns, 1) && pin_to_cpu(client, 2);
+
+        udp::endpoint client_endpoint(boost::asio::ip::address_v6::loopback(), client_port);
+        std::string input = encode(InputMessage(Move(Direction::Up)));
+        char reply[2];
+        for (size_t i = 0; i < iterations; i++) {
+            bench_clock::time_point sent = bench_clock::now();
+            gui.send_to(boost::asio::buffer(input), client_endpoint);
+            boost::asio::read(server, boost::asio::buffer(reply));
+            latencies.push_back(bench_clock::now() - sent);
+        }
+        stop.store(true);
+        client.join();
+        turns.join();
+        return pinned;
+    }
+
+    static size_t to_us(bench_clock::duration duration) {
+        return (size_t) std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    static size_t median(std::vector<size_t> values) {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    }
+
+    bool queued;
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor;
+    udp::socket gui;
+    uint16_t client_port;
+    std::unique_ptr<Uring> gui_ring;
+    std::unique_ptr<Uring> server_ring;
+    std::unique_ptr<Uring> send_ring;
+    TCPBuffer server_buffer;
+    tcp::socket server;
+    UDPBuffer gui_buffer;
+};
+
+// GUI datagrams decoded from memory, the way listen_to_gui sees them.
+void bench_input_decoding(const std::string &name, const std::string &datagram, size_t iterations,
+                          bool throwing) {
+    boost::asio::io_context io_context;
+    udp::socket socket(io_context);
+    MemoryInTransport transport(datagram);
+    UDPInBuffer buffer(socket, transport);
+    InputMessage input_message;
+    size_t valid = 0;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        if (throwing) {
+            // What the decoding cost when every malformed datagram threw.
+            try {
+                DecodeError error = decode(buffer, input_message);
+                if (error != DecodeError::None) {
+                    throw std::runtime_error(describe(error));
+                }
+                valid++;
+            } catch (std::runtime_error &) {}
+        } else {
+            valid += decode(buffer, input_message) == DecodeError::None;
+        }
+    }
+    report(name, iterations, bench_clock::now() - start);
+    if (valid != 0 && valid != iterations) {
+        std::cout << name << ": decoded " << valid << " of " << iterations << "\n";
+    }
+}
+
+void bench_turn_decoding(const std::string &name, size_t iterations) {
+    boost::asio::io_context io_context;
+    tcp::socket socket(io_context);
+    MemoryInTransport transport(encode(ServerMessage(bench_turn(1))));
+    TCPInBuffer buffer(socket, transport);
+    ServerMessage message;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        if (decode(buffer, message) != DecodeError::None) {
+            throw std::runtime_error("Turn not decoded.");
+        }
+    }
+    report(name, iterations, bench_clock::now() - start);
+}
+
+// Recorded turns replayed from memory.
+void bench_turn_replay(const std::string &name, size_t iterations) {
+    std::string turns;
+    for (game_length_t turn = 0; turn < 1000; turn++) {
+        turns += encode(ServerMessage(bench_turn(turn)));
+    }
+    MemoryInBuffer buffer(turns);
+    ServerMessage message;
+    bench_clock::time_point start = bench_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        if (buffer.get_left() == 0) {
+            buffer.restart();
+        }
+        if (decode(buffer, message) != DecodeError::None) {
+            throw std::runtime_error("Turn not decoded.");
+        }
+    }
+    report(name, iterations, bench_clock::now() - start);
+}
+
+// Turns of a game where every robot keeps placing bombs with a long timer, so thousands of them are live.
+void bench_bomb_spam(size_t iterations) {
+    const Bomb::timer_t timer = 1000;
+    const Bomb::id_t bombs_per_turn = 4;
+    game_length_t turns = (game_length_t) std::min<size_t>(iterations, 50000);
+    std::vector<Turn> recorded;
+    for (game_length_t turn = 0; turn < turns; turn++) {
+        std::vector<Event> events;
+        for (Bomb::id_t i = 0; i < bombs_per_turn; i++) {
+            Bomb::id_t id = turn * bombs_per_turn + i;
+            if (turn >= timer) {
+                events.push_back(BombExploded(id - timer * bombs_per_turn, {}, {}));
+            }
+            events.push_back(BombPlaced(id, Position((Position::coord_t) (id % 100), (Position::coord_t) (id / 100 % 100))));
+        }
+        recorded.push_back(Turn(turn, events));
+    }
+
+    DrawMessage game_state = Lobby(Hello("bench", 2, 100, 100, 60000, 5, timer)).start_game(GameStarted({
+        {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+    Game &game = std::get<Game>(game_state);
+    bench_clock::time_point start = bench_clock::now();
+    for (Turn &turn : recorded) {
+        game.process_turn(std::move(turn));
+        game.next_turn();
+    }
+    report("turns with " + std::to_string(timer * bombs_per_turn) + " live bombs", turns, bench_clock::now() - start);
+}
+
+// A turn in which a thousand bombs go off together on a 1000x1000 board a tenth full of blocks.
+void bench_explosions(size_t iterations) {
+    const Bomb::id_t bombs = 1000;
+    std::mt19937 random(1234);
+    std::vector<Event> placed, exploded;
+    for (size_t i = 0; i < 100000; i++) {
+        placed.push_back(BlockPlaced(Position((Position::coord_t) (random() % 1000), (Position::coord_t) (random() % 1000))));
+    }
+    for (Bomb::id_t id = 0; id < bombs; id++) {
+        placed.push_back(BombPlaced(id, Position((Position::coord_t) (random() % 1000), (Position::coord_t) (random() % 1000))));
+        exploded.push_back(BombExploded(id, {}, {}));
+    }
+
+    for (Bomb::explosion_rad_t radius : {(Bomb::explosion_rad_t) 5, (Bomb::explosion_rad_t) 500}) {
+        size_t rounds = std::max<size_t>(iterations / 2000, 1);
+        bench_clock::duration elapsed{};
+        for (size_t i = 0; i < rounds; i++) {
+            DrawMessage game_state = Lobby(Hello("bench", 2, 1000, 1000, 60000, radius, 1)).start_game(GameStarted({
+                {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+            Game &game = std::get<Game>(game_state);
+            game.process_turn(Turn(0, placed));
+            game.next_turn();
+            Turn turn(1, exploded);
+            bench_clock::time_point start = bench_clock::now();
+            game.process_turn(std::move(turn));
+            elapsed += bench_clock::now() - start;
+        }
+        report(std::to_string(bombs) + " explosions of radius " + std::to_string(radius), rounds, elapsed);
+    }
+}
+
+/* Decodes the turns of a recorded game, counting the allocations they take: owning
+ * turns, and views, whose events are decoded while iterating. */
+void bench_recorded_turn_decoding(size_t iterations) {
+    const game_length_t turns = 1000;
+    MemoryInBuffer recorded(record_game(bench_settings(), turns));
+    for (std::string mode : {"owning", "view"}) {
+        size_t allocated = allocations.load();
+        size_t events = 0;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            if (i % turns == 0) {
+                recorded.restart();
+            }
+            if (mode == "view") {
+                ServerMessageView message;
+                if (decode(recorded, message) != DecodeError::None) {
+                    throw std::runtime_error("Turn not decoded.");
+                }
+                for (const EventView &event : std::get<TurnView>(message)) {
+                    events += event.index();
+                }
+            } else {
+                ServerMessage message;
+                if (decode(recorded, message) != DecodeError::None) {
+                    throw std::runtime_error("Turn not decoded.");
+                }
+                for (const Event &event : std::get<Turn>(message).get_events()) {
+                    events += event.index();
+                }
+            }
+        }
+        bench_clock::duration elapsed = bench_clock::now() - start;
+        if (events == 0) {
+            throw std::runtime_error("No events decoded.");
+        }
+        std::ostringstream name;
+        name << "decode recorded turns, " << mode << ", " << std::fixed << std::setprecision(2)
+             << (double) (allocations.load() - allocated) / (double) iterations << " allocs";
+        report(name.str(), iterations, elapsed);
+    }
+}
+
+// Replays a recorded game the way the client handles turns: decode, update and encode the frame.
+void bench_replay(size_t iterations, bool view) {
+    const game_length_t turns = 1000;
+    Hello settings = bench_settings();
+    MemoryInBuffer recorded(record_game(settings, turns));
+    MemoryOutBuffer frame;
+    ServerMessage message;
+    ServerMessageView message_view;
+    size_t replayed = 0;
+    bench_clock::duration elapsed{};
+    while (replayed < iterations) {
+        recorded.restart();
+        DrawMessage game_state = Lobby(Hello(settings)).start_game(GameStarted({
+            {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+        Game &game = std::get<Game>(game_state);
+        bench_clock::time_point start = bench_clock::now();
+        for (game_length_t turn = 0; turn < turns; turn++) {
+            if (view) {
+                if (decode(recorded, message_view) != DecodeError::None) {
+                    throw std::runtime_error("Turn not decoded.");
+                }
+                game.process_turn(std::get<TurnView>(message_view));
+            } else {
+                if (decode(recorded, message) != DecodeError::None) {
+                    throw std::runtime_error("Turn not decoded.");
+                }
+                game.process_turn(std::move(std::get<Turn>(message)));
+            }
+            frame << game_state;
+            frame.discard();
+            game.next_turn();
+        }
+        elapsed += bench_clock::now() - start;
+        replayed += turns;
+    }
+    report(std::string("replay turns on a block-heavy map") + (view ? ", views" : ""), replayed, elapsed);
+}
+
+// Messages keyed by player id, with the 25 players of a crowded game.
+void bench_player_table_decoding(size_t iterations) {
+    PlayerTable<Player> players;
+    PlayerTable<score_t> scores;
+    for (Player::id_t id = 0; id < 25; id++) {
+        players[id] = Player("Player number " + std::to_string(id), "[2001:db8::" + std::to_string(id) + "]:40001");
+        scores[id] = id;
+    }
+    for (const ServerMessage &recorded : {ServerMessage(GameStarted(players)), ServerMessage(GameEnded(scores))}) {
+        MemoryInBuffer buffer(encode(recorded));
+        ServerMessage message;
+        bench_clock::time_point start = bench_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            buffer.restart();
+            if (decode(buffer, message) != DecodeError::None) {
+                throw std::runtime_error("Message not decoded.");
+            }
+        }
+        report(std::string("decode ") + (recorded.index() == 2 ? "game started" : "game ended") + " with 25 players",
+               iterations, bench_clock::now() - start);
+    }
+}
+
+void bench_decoding(size_t iterations) {
+    std::string valid = encode(InputMessage(Move(Direction::Up)));
+    std::string unknown_type("\xff", 1);
+    std::string trailing = valid + '\0';
+    bench_input_decoding("decode valid input", valid, iterations, false);
+    bench_input_decoding("decode unknown input type", unknown_type, iterations, false);
+    bench_input_decoding("decode input with trailing data", trailing, iterations, false);
+    bench_input_decoding("decode unknown input type, throwing", unknown_type, iterations, true);
+    bench_input_decoding("decode input with trailing data, throwing", trailing, iterations, true);
+    bench_turn_decoding("decode turn", iterations);
+    bench_turn_replay("replay turns from memory", iterations);
+    bench_player_table_decoding(iterations);
+}
+
+size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+/* Idle lobby sessions: what the clients report holding, and how much the heap
+ * grows per session, which also counts the io_context, sockets and game state. */
+void bench_session_memory(size_t sessions) {
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    udp::socket gui(io_context, udp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    std::string hello = encode(ServerMessage(bench_settings()));
+    std::vector<uint16_t> ports;
+    {
+        // Held open together, so that no port is handed out twice.
+        std::vector<udp::socket> sockets;
+        for (size_t i = 0; i < sessions; i++) {
+            sockets.emplace_back(io_context, udp::endpoint(udp::v6(), 0));
+            ports.push_back(sockets.back().local_endpoint().port());
+        }
+    }
+
+    // Plain file descriptors, so that the fake server does not count as session memory.
+    std::vector<int> server_fds;
+    std::thread server([&acceptor, &hello, &server_fds, sessions]() {
+        for (size_t i = 0; i < sessions; i++) {
+            int fd = accept(acceptor.native_handle(), nullptr, nullptr);
+            if (write(fd, hello.data(), hello.size()) != (ssize_t) hello.size()) {
+                throw std::runtime_error("Hello not sent.");
+            }
+            server_fds.push_back(fd);
+        }
+    });
+
+    size_t reported = 0;
+    size_t heap_before = heap_in_use();
+    {
+        std::vector<std::unique_ptr<Client>> clients;
+        for (size_t i = 0; i < sessions; i++) {
+            clients.push_back(std::make_unique<Client>("bench", loopback(acceptor.local_endpoint().port()),
+                                                       std::vector<EndPoint>{loopback(gui.local_endpoint().port())},
+                                                       ports[i]));
+        }
+        size_t heap_per_session = (heap_in_use() - heap_before) / sessions;
+        for (std::unique_ptr<Client> &client : clients) {
+            reported += client->get_memory_usage();
+        }
+        std::cout << std::left << std::setw(44) << "idle lobby session memory" << std::right
+                  << std::setw(12) << reported / sessions << " B reported"
+                  << std::setw(12) << heap_per_session << " B heap\n";
+    }
+    server.join();
+    for (int fd : server_fds) {
+        close(fd);
+    }
+}
+
+void bench_transports(size_t iterations) {
+    for (bool io_uring : {false, true}) {
+        std::string backend = io_uring ? "io_uring" : "asio";
+        LoopbackBench bench(io_uring);
+        if (io_uring && !bench.has_rings()) {
+            std::cout << backend << ": not available\n";
+            continue;
+        }
+        bench.input_to_move(backend + " loopback input -> move", iterations);
+        {
+            LoopbackBench queued_bench(io_uring, true);
+            queued_bench.input_to_move(backend + " loopback input -> move, queued", iterations);
+            queued_bench.inputs_to_stalled_server(backend + " inputs to a stalled server, queued", iterations);
+        }
+        bench.input_burst_to_moves(backend + " loopback 32 inputs -> moves", iterations, 32);
+        bench.turn_to_frame(backend + " loopback turn -> frame", iterations);
+        // The sender would share the ring of the thread applying turns, Client gives it its own.
+        if (!io_uring) {
+            bench.turn_flood_to_frame(backend + " turn flood -> frames, inline", false);
+            bench.turn_flood_to_frame(backend + " turn flood -> frames, sender", true);
+        }
+        bench.backlog_to_frame(backend + " 16 backlogged turns -> frames", iterations, 16, false);
+        bench.backlog_to_frame(backend + " 16 backlogged turns -> latest", iterations, 16, true);
+        bench.input_during_turns(backend + " input vs turns", iterations / 10, 5);
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 20000;
+    bench_decoding(iterations * 50);
+    bench_frame_encoding(iterations);
+    bench_crowded_frame_encoding(iterations);
+    bench_recorded_turn_decoding(iterations);
+    bench_replay(iterations, false);
+    bench_replay(iterations, true);
+    bench_bomb_spam(iterations);
+    bench_explosions(iterations);
+    bench_byteswap(iterations * 10);
+    bench_position_list_decoding(iterations);
+    bench_session_memory(32);
+    bench_transports(iterations);
+}
@@ -1,11 +1,13 @@
 #ifndef __BUFFERS_H__
 #define __BUFFERS_H__
 
+#include <utility>
 #include <boost/asio.hpp>
 
 #include "buffers_utils.hpp"
 #include "inbuffers.hpp"
 #include "outbuffers.hpp"
+#include "transports.hpp"
 #include "../parse_args.hpp"
 #include "../utils.hpp"
 
@@ -15,30 +17,108 @@ using boost::asio::ip::udp;
 
 class UDPBuffer {
 public:
-    UDPBuffer(boost::asio::io_context &io_context, uint16_t port, EndPoint _endpoint)
+    /* The rings, when given, are used for receiving and sending respectively,
+     * otherwise the socket is used directly. */
+    UDPBuffer(boost::asio::io_context &io_context, uint16_t port, std::vector<EndPoint> _endpoints,
+              Uring *in_ring = nullptr, Uring *out_ring = nullptr)
     : socket(io_context, udp::endpoint(udp::v6(), port)),
-      endpoint(*udp::resolver(io_context).resolve(_endpoint.get_ip(), _endpoint.get_port()).begin()),
-      in_buffer(socket, endpoint), out_buffer(socket, endpoint) {}
+      endpoints(resolve(io_context, _endpoints)),
+      in_transport(make_in_transport(socket, in_ring)),
+      out_transport(make_out_transport(socket, endpoints, out_ring)),
+      in_buffer(socket, *in_transport), out_buffer(*out_transport) {}
+
+    // Largest UDP payload over IPv4, IPv6 allows slightly more.
+    static const size_t MAX_DATAGRAM_SIZE = 65507;
 
     void send() {
         out_buffer.send();
     }
 
+    // Sends bytes encoded elsewhere as one datagram, without copying them first.
+    void send(const std::string &bytes) {
+        out_buffer.write_ref(bytes.data(), bytes.size());
+        out_buffer.send();
+    }
+
+    void reserve(size_t n) {
+        out_buffer.reserve(n);
+    }
+
+    // Give storage grown for big messages back to the pool, each from the thread using that direction.
+    void trim_receiving() {
+        in_buffer.trim();
+    }
+
+    void trim_sending() {
+        out_buffer.trim();
+    }
+
+    size_t get_memory_usage() {
+        return in_buffer.get_memory_usage() + out_buffer.get_memory_usage()
+             + in_transport->get_memory_usage() + out_transport->get_memory_usage();
+    }
+
+    void set_blocking(bool blocking) {
+        in_buffer.set_blocking(blocking);
+    }
+
+    // Decodes the next datagram into val, skipping it if it is malformed.
+    template <typename T>
+    DecodeError receive(T &val) {
+        return decode(in_buffer, val);
+    }
+
+    // Waits for the next datagram and decodes it into val.
+    template <typename T>
+    boost::asio::awaitable<DecodeError> async_receive(T &val) {
+        co_await in_buffer.async_receive();
+        co_return decode(in_buffer, val);
+    }
+
+    /* Decodes every datagram that has already arrived, blocking only until
+     * the first one does. Malformed datagrams are skipped. */
+    template <typename T>
+    void receive_batch(std::vector<T> &values) {
+        values.clear();
+        do {
+            T val;
+            if (decode(in_buffer, val) == DecodeError::None) {
+                values.push_back(std::move(val));
+            }
+        } while (in_transport->pending() > 0);
+    }
+
 protected:
     udp::socket socket;
-    udp::endpoint endpoint;
+    std::vector<udp::endpoint> endpoints;
+    std::unique_ptr<InTransport> in_transport;
+    std::unique_ptr<OutTransport> out_transport;
     UDPInBuffer in_buffer;
     UDPOutBuffer out_buffer;
 
+    static std::vector<udp::endpoint> resolve(boost::asio::io_context &io_context,
+                                              std::vector<EndPoint> &endpoints) {
+        udp::resolver resolver(io_context);
+        std::vector<udp::endpoint> resolved;
+        for (EndPoint &endpoint : endpoints) {
+            resolved.push_back(*resolver.resolve(endpoint.get_ip(), endpoint.get_port()).begin());
+        }
+        return resolved;
+    }
+
     template <typename T>
     friend UDPBuffer &operator<<(UDPBuffer &buff, const T &val) {
         buff.out_buffer << val;
         return buff;
     }
 
+    // Throwing counterpart of receive().
     template <typename T>
     friend UDPBuffer &operator>>(UDPBuffer &buff, T &val) {
-        buff.in_buffer >> val;
+        DecodeError error = buff.receive(val);
+        if (error != DecodeError::None) {
+            throw std::runtime_error(describe(error));
+        }
         return buff;
     }
 };
@@ -46,34 +126,129 @@ protected:
 
 class TCPBuffer {
 public:
-    TCPBuffer(boost::asio::io_context &io_context, EndPoint endpoint)
-    : socket(io_context), in_buffer(socket), out_buffer(socket) {
-        tcp::resolver tcp_resolver(io_context);
-        tcp::resolver::results_type tcp_endpoints = tcp_resolver.resolve(endpoint.get_ip(), endpoint.get_port());        
-        socket.open(tcp::v6());
-        socket.set_option(tcp::no_delay(true));
-        boost::asio::connect(socket, tcp_endpoints);
-    }
+    TCPBuffer(boost::asio::io_context &io_context, EndPoint endpoint,
+              Uring *in_ring = nullptr, Uring *out_ring = nullptr)
+    : socket(connect(io_context, endpoint)),
+      in_transport(make_in_transport(socket, in_ring)),
+      out_transport(make_out_transport(socket, out_ring)),
+      in_buffer(socket, *in_transport), out_buffer(*out_transport) {}
 
     void send() {
         out_buffer.send();
     }
 
+    // See TCPOutBuffer for the send queue.
+    bool queue_send(bool droppable = true) {
+        return out_buffer.queue(droppable);
+    }
+
+    void write_send_queue() {
+        out_buffer.write_queue();
+    }
+
+    void close_send_queue() {
+        out_buffer.close_queue();
+    }
+
+    bool claim_send_writer() {
+        return out_buffer.claim_writer();
+    }
+
+    boost::asio::awaitable<void> async_write_send_queue() {
+        co_await out_buffer.async_write_queue();
+    }
+
+    size_t get_dropped_sends() {
+        return out_buffer.get_dropped();
+    }
+
+    void trim_receiving() {
+        in_buffer.trim();
+    }
+
+    void trim_sending() {
+        out_buffer.trim();
+    }
+
+    size_t get_memory_usage() {
+        return in_buffer.get_memory_usage() + out_buffer.get_memory_usage() + out_buffer.get_queue_memory_usage()
+             + in_transport->get_memory_usage() + out_transport->get_memory_usage();
+    }
+
+    void set_blocking(bool blocking) {
+        in_buffer.set_blocking(blocking);
+    }
+
+    // Decodes the next message into val, blocking until it arrives.
+    template <typename T>
+    DecodeError receive(T &val) {
+        return decode(in_buffer, val);
+    }
+
+    /* Decodes the next message only if all of it has already been received. Otherwise
+     * returns DecodeError::Incomplete and leaves it to receive() or async_receive().
+     * The transport is only asked for more once the buffered bytes run out. */
+    template <typename T>
+    DecodeError try_receive(T &val) {
+        bool blocking = in_buffer.is_blocking();
+        in_buffer.set_blocking(false);
+        DecodeError error = decode(in_buffer, val);
+        if (error == DecodeError::Incomplete) {
+            in_buffer.rewind();
+            in_buffer.read_pending();
+            error = decode(in_buffer, val);
+            if (error == DecodeError::Incomplete) {
+                in_buffer.rewind();
+            }
+        }
+        in_buffer.set_blocking(blocking);
+        return error;
+    }
+
+    // Decodes val once all of its bytes have arrived, waiting for more data as needed.
+    template <typename T>
+    boost::asio::awaitable<DecodeError> async_receive(T &val) {
+        for (;;) {
+            DecodeError error = decode(in_buffer, val);
+            if (error != DecodeError::Incomplete) {
+                co_return error;
+            }
+            in_buffer.rewind();
+            co_await in_buffer.async_receive();
+        }
+    }
+
 protected:
     tcp::socket socket;
     tcp::endpoint endpoint;
+    std::unique_ptr<InTransport> in_transport;
+    std::unique_ptr<OutTransport> out_transport;
     TCPInBuffer in_buffer;
     TCPOutBuffer out_buffer;
 
+    // Connecting may reopen the socket, so options are set afterwards.
+    static tcp::socket connect(boost::asio::io_context &io_context, EndPoint endpoint) {
+        tcp::resolver tcp_resolver(io_context);
+        tcp::resolver::results_type tcp_endpoints = tcp_resolver.resolve(endpoint.get_ip(), endpoint.get_port());
+        tcp::socket socket(io_context);
+        boost::asio::connect(socket, tcp_endpoints);
+        socket.set_option(tcp::no_delay(true));
+        return socket;
+    }
+
     template <typename T>
     friend TCPBuffer &operator<<(TCPBuffer &buff, const T &val) {
         buff.out_buffer << val;
         return buff;
     }
 
+    // Throwing counterpart of receive().
     template <typename T>
     friend TCPBuffer &operator>>(TCPBuffer &buff, T &val) {
-        buff.in_buffer >> val;
+        DecodeError error = buff.receive(val);
+        if (error != DecodeError::None) {
+            throw std::runtime_error(describe(error));
+        }
         return buff;
     }
 };
@@ -1,6 +1,7 @@
 #ifndef __BUFFERS_UTILS_H__
 #define __BUFFERS_UTILS_H__
 
+#include <utility>
 #include <boost/asio.hpp>
 #include <concepts>
 
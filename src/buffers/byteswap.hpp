@@ -0,0 +1,108 @@
+#ifndef __BYTESWAP_H__
+#define __BYTESWAP_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BYTESWAP_X86
+#endif
+
+/* Byte order conversion of whole arrays of equally sized words, used for lists
+ * of fixed-size elements. The x86 versions shuffle 16 or 32 bytes at a time
+ * and are picked at run time, everything else falls back to a scalar loop. */
+
+// Copies count words of WORD bytes from src to dest (which may be the same) reversing each.
+template <size_t WORD>
+void byteswap_words_scalar(char *dest, const char *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if constexpr (WORD == 2) {
+            uint16_t word;
+            memcpy(&word, src + i * WORD, WORD);
+            word = __builtin_bswap16(word);
+            memcpy(dest + i * WORD, &word, WORD);
+        } else {
+            static_assert(WORD == 4);
+            uint32_t word;
+            memcpy(&word, src + i * WORD, WORD);
+            word = __builtin_bswap32(word);
+            memcpy(dest + i * WORD, &word, WORD);
+        }
+    }
+}
+
+// Shuffle control reversing every WORD bytes of an N byte vector.
+template <size_t WORD, size_t N>
+constexpr std::array<char, N> byteswap_mask() {
+    std::array<char, N> mask{};
+    for (size_t i = 0; i < N; i++)
+        mask[i] = (char) (i ^ (WORD - 1));
+    return mask;
+}
+
+#ifdef BYTESWAP_X86
+template <size_t WORD>
+__attribute__((target("ssse3")))
+void byteswap_words_ssse3(char *dest, const char *src, size_t count) {
+    static constexpr std::array<char, 16> mask_bytes = byteswap_mask<WORD, 16>();
+    const __m128i mask = _mm_loadu_si128((const __m128i *) mask_bytes.data());
+    size_t n = count * WORD;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i words = _mm_loadu_si128((const __m128i *) (src + i));
+        _mm_storeu_si128((__m128i *) (dest + i), _mm_shuffle_epi8(words, mask));
+    }
+    byteswap_words_scalar<WORD>(dest + i, src + i, (n - i) / WORD);
+}
+
+template <size_t WORD>
+__attribute__((target("avx2")))
+void byteswap_words_avx2(char *dest, const char *src, size_t count) {
+    static constexpr std::array<char, 32> mask_bytes = byteswap_mask<WORD, 32>();
+    const __m256i mask = _mm256_loadu_si256((const __m256i *) mask_bytes.data());
+    size_t n = count * WORD;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i words = _mm256_loadu_si256((const __m256i *) (src + i));
+        _mm256_storeu_si256((__m256i *) (dest + i), _mm256_shuffle_epi8(words, mask));
+    }
+    byteswap_words_scalar<WORD>(dest + i, src + i, (n - i) / WORD);
+}
+
+enum class ByteswapLevel { Scalar, SSSE3, AVX2 };
+
+ByteswapLevel byteswap_level() {
+    static const ByteswapLevel level = __builtin_cpu_supports("avx2") ? ByteswapLevel::AVX2
+        : __builtin_cpu_supports("ssse3") ? ByteswapLevel::SSSE3
+        : ByteswapLevel::Scalar;
+    return level;
+}
+#endif
+
+template <size_t WORD>
+void byteswap_words(char *dest, const char *src, size_t count) {
+    if constexpr (WORD == 1) {
+        if (dest != src)
+            memmove(dest, src, count);
+        return;
+    } else {
+#ifdef BYTESWAP_X86
+        switch (byteswap_level()) {
+            case ByteswapLevel::AVX2:
+                byteswap_words_avx2<WORD>(dest, src, count);
+                return;
+            case ByteswapLevel::SSSE3:
+                byteswap_words_ssse3<WORD>(dest, src, count);
+                return;
+            default:
+                break;
+        }
+#endif
+        byteswap_words_scalar<WORD>(dest, src, count);
+    }
+}
+
+#endif // __BYTESWAP_H__
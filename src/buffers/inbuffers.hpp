@@ -1,67 +1,254 @@
 #ifndef __INBUFFERS_H__
 #define __INBUFFERS_H__
 
+#include <utility> // before asio, boost 1.74 awaitable.hpp uses std::exchange without it
 #include <boost/asio.hpp>
-#include <boost/asio/detail/socket_ops.hpp>
+#include <boost/container/small_vector.hpp>
 #include <string>
 #include <exception>
 #include <variant>
+#include <array>
 #include <limits>
 #include <list>
 #include <map>
+#include <memory>
+#include <vector>
 #include <exception>
 #include <iostream>
 
 #include "buffers_utils.hpp"
+#include "byteswap.hpp"
+#include "pool.hpp"
+#include "schema.hpp"
+#include "transports.hpp"
+#include "../id_table.hpp"
 #include "../utils.hpp"
 
 using boost::asio::ip::udp;
 using boost::asio::ip::tcp;
 
+// Why decoding a message failed.
+enum class DecodeError {
+    None,
+    NotEnoughData,
+    UnknownType,
+    TrailingData,
+    Incomplete, // a non-blocking buffer has not received the whole message yet
+};
+
+const char *describe(DecodeError error) {
+    switch (error) {
+        case DecodeError::None: return "No error.";
+        case DecodeError::NotEnoughData: return "Not enough data.";
+        case DecodeError::UnknownType: return "Structure type index out of bounds.";
+        case DecodeError::TrailingData: return "Trailing data.";
+        case DecodeError::Incomplete: return "Incomplete message.";
+    }
+    return "Unknown error.";
+}
+
+/* Decoding never throws on malformed input. The first error is recorded
+ * instead and every later read leaves its destination zeroed. */
 class InBuffer {
 public:
     void read_data(void *dest, size_t n) {
-        read_from_socket(n);
+        const char *src = take(n);
+        if (src == nullptr) {
+            memset(dest, 0, n);
+            return;
+        }
+
+        memcpy(dest, src, n);
+    }
 
-        if (size - read < n) {
-            throw std::runtime_error("Not enough data.");
+    // Decodes a fixed-size value with a single bounds check.
+    template <fixed_wire_size T>
+    void read_fixed(T &val) {
+        const char *src = take(wire_size<T>());
+        if (src == nullptr) {
+            val = T();
+            return;
         }
 
-        memcpy(dest, data + read, n);
-        read += n;
-        if (read == size) {
-            read = 0;
-            size = 0;
+        load(src, val);
+    }
+
+    /* Appends count fixed-size elements to the container. They are taken a chunk
+     * at a time and converted to host byte order all at once. */
+    template <typename Container>
+    void read_fixed_elements(Container &container, size_t count) {
+        using T = typename Container::value_type;
+        constexpr size_t WORD = wire_word_size<T>();
+        constexpr size_t CHUNK = 256 / wire_size<T>();
+        char host[CHUNK * wire_size<T>()];
+        while (count > 0 && ok()) {
+            size_t n = std::min(count, CHUNK);
+            const char *src = take(n * wire_size<T>());
+            if (src == nullptr) {
+                return;
+            }
+            if constexpr (std::endian::native == std::endian::little) {
+                byteswap_words<WORD>(host, src, n * wire_size<T>() / WORD);
+                src = host;
+            }
+            for (size_t i = 0; i < n; i++) {
+                src = load<false>(src, container.emplace_back());
+            }
+            count -= n;
+        }
+    }
+
+    /* Moves past n bytes, taking them a block at a time so that a corrupted
+     * length cannot make the buffer grow all at once. */
+    void skip(size_t n) {
+        while (n > 0 && ok()) {
+            size_t chunk = std::min(n, (size_t) BufferPool::MIN_BLOCK_SIZE);
+            take(chunk);
+            n -= chunk;
         }
     }
 
-    char *get_data() { return data; }
+    char *get_data() { return data.get(); }
 
     size_t get_size() { return size; }
 
     size_t get_left() { return size - read; }
 
+    /* A non-blocking buffer only decodes what has already been received
+     * and leaves waiting for more data to the caller. */
+    void set_blocking(bool blocking) { this->blocking = blocking; }
+
+    bool is_blocking() { return blocking; }
+
+    // Marks where the message about to be decoded starts.
+    void begin_message() { message_start = read; }
+
+    // Goes back to the start of a partially decoded message.
+    void rewind() { read = message_start; }
+
+    // Offset of the next byte from the start of the message, kept when the buffer moves its data.
+    size_t get_message_offset() { return read - message_start; }
+
+    /* Bytes of the message being decoded, from offset on. The whole message stays
+     * in the buffer until the next one is decoded. */
+    const char *get_message_data(size_t offset) { return data.get() + message_start + offset; }
+
+    size_t get_memory_usage() { return data.size(); }
+
+    // Gives grown storage back to the pool, keeping whatever is still unread.
+    void trim() {
+        size_t left = size - read;
+        if (data.size() > INITIAL_CAPACITY && left <= INITIAL_CAPACITY) {
+            PooledBlock trimmed(INITIAL_CAPACITY);
+            memcpy(trimmed.get(), data.get() + read, left);
+            data = std::move(trimmed);
+            size = left;
+            read = 0;
+            message_start = 0;
+        }
+    }
+
+    bool ok() { return error == DecodeError::None; }
+
+    DecodeError get_error() { return error; }
+
+    // Records the first error of the message being decoded.
+    void fail(DecodeError error) {
+        if (ok()) {
+            this->error = error;
+        }
+    }
+
+    void clear_error() { error = DecodeError::None; }
+
 protected:
     size_t size = 0;
     size_t read = 0;
-    static const size_t CAPACITY = 65536;
-    char data [CAPACITY];
+    size_t message_start = 0;
+    bool blocking = true;
+    DecodeError error = DecodeError::None;
+    static const size_t INITIAL_CAPACITY = BufferPool::MIN_BLOCK_SIZE;
+    PooledBlock data{INITIAL_CAPACITY};
+
+    /* Returns the next n bytes, or nullptr once the message turns out malformed.
+     * Only a buffer running short calls into the socket, so decoding what is
+     * already buffered involves no virtual calls and inlines completely. */
+    const char *take(size_t n) {
+        if (size - read < n && ok()) {
+            read_from_socket(n);
+        }
+
+        if (!ok() || size - read < n) {
+            fail(DecodeError::NotEnoughData);
+            return nullptr;
+        }
+
+        const char *src = data.get() + read;
+        read += n;
+        return src;
+    }
 
 private:
-    virtual void read_from_socket(size_t) = 0;
+    // Called when fewer than n bytes are left, buffers more of them if it can.
+    virtual void read_from_socket(size_t n) = 0;
+};
+
+// Decodes messages from bytes already in memory, such as recorded ones being replayed.
+class MemoryInBuffer : public InBuffer {
+public:
+    MemoryInBuffer() = default;
+
+    MemoryInBuffer(const std::string &bytes) {
+        assign(bytes.data(), bytes.size());
+    }
+
+    // Replaces the contents with a copy of n bytes.
+    void assign(const void *src, size_t n) {
+        if (n > data.size()) {
+            data = PooledBlock(n);
+        }
+        memcpy(data.get(), src, n);
+        size = n;
+        restart();
+    }
+
+    // Goes back to the first message.
+    void restart() {
+        read = 0;
+        message_start = 0;
+    }
+
+private:
+    virtual void read_from_socket(size_t) {}
 };
 
 class UDPInBuffer : public InBuffer {
 public:
-    UDPInBuffer(udp::socket &socket, udp::endpoint &endpoint) : socket(socket), endpoint(endpoint) {}
+    UDPInBuffer(udp::socket &socket, InTransport &transport) : socket(socket), transport(transport) {}
+
+    // Drops the rest of a malformed datagram, so that it is not decoded as the next message.
+    void skip_datagram() { read = size; }
+
+    // Receives the next datagram, dropping whatever is left of the previous one.
+    boost::asio::awaitable<void> async_receive() {
+        read = 0;
+        message_start = 0;
+        size = co_await socket.async_receive(boost::asio::buffer(data.get(), data.size()),
+                                             boost::asio::use_awaitable);
+    }
 
 private:
     udp::socket &socket;
-    udp::endpoint &endpoint;
+    InTransport &transport;
 
+    /* A new datagram is only received for the first read of a message,
+     * a message cut short is malformed rather than continued in the next one. */
     virtual void read_from_socket(size_t) {
-        if (size - read == 0) {
-            size_t n_received = socket.receive(boost::asio::buffer(data + size, InBuffer::CAPACITY - size));
+        if (size - read == 0 && read == message_start && blocking) {
+            read = 0;
+            size = 0;
+            message_start = 0;
+            size_t n_received = transport.receive(data.get() + size, data.size() - size);
             size += n_received;
         }
     }
@@ -69,33 +256,86 @@ private:
 
 class TCPInBuffer : public InBuffer {
 public:
-    TCPInBuffer(tcp::socket &socket) : socket(socket) {}
+    TCPInBuffer(tcp::socket &socket, InTransport &transport) : socket(socket), transport(transport) {}
+
+    static const size_t MAX_READ_AHEAD = 65536;
+
+    // Reads whatever the kernel has, waiting until at least one byte arrives.
+    boost::asio::awaitable<void> async_receive() {
+        compact(message_start);
+        if (size == data.size()) {
+            data.resize(2 * size, size);
+        }
+
+        size += co_await socket.async_read_some(boost::asio::buffer(data.get() + size, data.size() - size),
+                                                boost::asio::use_awaitable);
+    }
+
+    /* Buffers whatever the transport has already received, without waiting
+     * for more. Called between messages. */
+    void read_pending() {
+        begin_message();
+        while (transport.pending() > 0) {
+            if (size == data.size()) {
+                compact(message_start);
+            }
+            if (size == data.size()) {
+                if (data.size() >= MAX_READ_AHEAD)
+                    return;
+                data.resize(2 * size, size);
+            }
+            size += transport.receive(data.get() + size, data.size() - size);
+        }
+    }
 
 private:
     tcp::socket &socket;
+    InTransport &transport;
 
-    virtual void read_from_socket(size_t n) {
-        size_t n_received = boost::asio::read(socket, boost::asio::buffer(data + size, n));
-        size += n_received;
+    // Moves the bytes starting at keep to the front of the buffer.
+    void compact(size_t keep) {
+        memmove(data.get(), data.get() + keep, size - keep);
+        size -= keep;
+        read -= keep;
+        message_start -= std::min(message_start, keep);
     }
-};
 
+    /* Makes sure at least n bytes are buffered. Reads ahead whatever the kernel
+     * already has, so consecutive fields and messages are decoded from memory. */
+    virtual void read_from_socket(size_t n) {
+        if (size - read >= n) {
+            return;
+        }
+
+        if (!blocking) {
+            fail(DecodeError::Incomplete);
+            return;
+        }
 
-template <supported_integral T>
-T network_to_host(const T &val) {
-    if (sizeof(T) == 1) {
-        return val;
-    } else if (sizeof(T) == 2) {
-        return boost::asio::detail::socket_ops::network_to_host_short(val);
-    } else if (sizeof(T) == 4) {
-        return boost::asio::detail::socket_ops::network_to_host_long(val);
+        // The message is kept whole, so that views of it stay valid once it is decoded.
+        if (read == size || data.size() - read < n) {
+            compact(message_start);
+        }
+        if (data.size() - read < n) {
+            data.resize(read + n, size);
+        }
+
+        while (size - read < n) {
+            size_t free = data.size() - size;
+            size_t received = transport.receive(data.get() + size, free);
+            size += received;
+            // The kernel probably has more, read ahead further next time.
+            if (received == free && data.size() < MAX_READ_AHEAD) {
+                data.resize(2 * data.size(), size);
+            }
+        }
     }
-}
+};
+
 
 template <supported_integral T>
 InBuffer &operator>>(InBuffer &buff, T &val) {
-    buff.read_data(&val, sizeof(val));
-    val = host_to_network(val);
+    buff.read_fixed(val);
     return buff;
 }
 
@@ -108,66 +348,171 @@ InBuffer &operator>>(InBuffer &buff, std::string &str) {
     return buff;
 }
 
-template <class V, std::size_t I = 0>
-V variant_from_index(uint8_t index) {
-    if constexpr(I >= std::variant_size_v<V>)
-        throw std::runtime_error("Structure type index " + std::to_string(I + index) + " out of bounds");
+template <class V, std::size_t... Is>
+constexpr auto variant_decoders(std::index_sequence<Is...>) {
+    return std::array<void (*)(InBuffer &, V &), sizeof...(Is)>{
+        [](InBuffer &buff, V &variant) { buff >> variant.template emplace<Is>(); }...
+    };
+}
+
+/* Makes the alternative with the given index and decodes it, dispatching through
+ * a table built at compile time. Returns false if index is out of bounds. */
+template <class V>
+bool variant_from_index(InBuffer &buff, uint8_t index, V &variant) {
+    static constexpr auto decoders = variant_decoders<V>(std::make_index_sequence<std::variant_size_v<V>>());
+    if (index >= decoders.size())
+        return false;
+    decoders[index](buff, variant);
+    return true;
+}
+
+// Moves past a value without decoding it, views know their own layout.
+template <typename T>
+void skip_value(InBuffer &buff) {
+    if constexpr (fixed_wire_size<T>)
+        buff.skip(wire_size<T>());
     else
-        return index == 0
-            ? V{std::in_place_index<I>}
-            : variant_from_index<V, I + 1>(index - 1);
+        T::skip(buff);
+}
+
+// Skips the alternative with the given index. Returns false if index is out of bounds.
+template <class V>
+bool skip_from_index(InBuffer &buff, uint8_t index) {
+    static constexpr auto skippers = []<std::size_t... Is>(std::index_sequence<Is...>) {
+        return std::array<void (*)(InBuffer &), sizeof...(Is)>{&skip_value<std::variant_alternative_t<Is, V>>...};
+    }(std::make_index_sequence<std::variant_size_v<V>>());
+    if (index >= skippers.size())
+        return false;
+    skippers[index](buff);
+    return true;
 }
 
 template <class... Ts>
 InBuffer &operator>>(InBuffer &buff, std::variant<Ts...> &variant) {
-        using variant_t = std::variant<Ts...>;
         uint8_t index;
         buff >> index;
-        variant = variant_from_index<variant_t>(index);
-        std::visit([&buff](auto &val){ buff >> val; }, variant);
+        if (buff.ok() && !variant_from_index(buff, index, variant)) {
+            buff.fail(DecodeError::UnknownType);
+        }
         return buff;
 }
 
+// A datagram holds exactly one message.
 template <class... Ts>
 UDPInBuffer &operator>>(UDPInBuffer &buff, std::variant<Ts...> &variant) {
+    buff.begin_message();
     (InBuffer &) buff >> variant;
-    if (buff.get_left() > 0) {
-        throw std::runtime_error("Trailing data.");
+    if (buff.ok() && buff.get_left() > 0) {
+        buff.fail(DecodeError::TrailingData);
+    }
+    if (!buff.ok()) {
+        buff.skip_datagram();
     }
     return buff;
 }
 
 template <typename U, typename V>
 InBuffer &operator>>(InBuffer &buff, std::pair<U, V> &pair) {
-    buff >> pair.first >> pair.second;
+    if constexpr (fixed_wire_size<std::pair<U, V>>) {
+        buff.read_fixed(pair);
+    } else {
+        buff >> pair.first >> pair.second;
+    }
     return buff;
 }
 
-template <typename T>
-InBuffer &operator>>(InBuffer &buff, std::list<T> &list) {
+/* A list, vector or small_vector comes off the wire the same way. Vectors are sized
+ * up front from the length, but only for as many elements as the bytes received so
+ * far can hold, so a corrupted length cannot make them allocate much. */
+template <typename Container>
+InBuffer &read_list(InBuffer &buff, Container &list) {
+    using T = typename Container::value_type;
     uint32_t list_size;
     buff >> list_size;
-    list = std::list<T>(list_size);
-    for (T &val : list) {
-        buff >> val;
+    list.clear();
+    if constexpr (requires { list.reserve(list_size); }) {
+        size_t min_size = 1;
+        if constexpr (fixed_wire_size<T>)
+            min_size = wire_size<T>();
+        list.reserve(std::min<size_t>(list_size, buff.get_left() / min_size));
+    }
+    if constexpr (bulk_swappable<T>) {
+        buff.read_fixed_elements(list, list_size);
+    } else {
+        while (list_size-- && buff.ok()) {
+            buff >> list.emplace_back();
+        }
     }
 
     return buff;
 }
 
+template <typename T>
+InBuffer &operator>>(InBuffer &buff, std::list<T> &list) {
+    return read_list(buff, list);
+}
+
+template <typename T>
+InBuffer &operator>>(InBuffer &buff, std::vector<T> &vector) {
+    return read_list(buff, vector);
+}
+
+template <typename T, size_t N>
+InBuffer &operator>>(InBuffer &buff, boost::container::small_vector<T, N> &vector) {
+    return read_list(buff, vector);
+}
+
 template <typename U, typename V>
 InBuffer &operator>>(InBuffer &buff, std::map<U, V> &map) {
     uint32_t map_size;
     buff >> map_size;
     map.clear();
-    while (map_size--) {
-        U key;
-        V value;
-        buff >> key >> value;
-        map[key] = value;
+    while (map_size-- && buff.ok()) {
+        std::pair<U, V> key_val;
+        buff >> key_val;
+        if (buff.ok())
+            map[key_val.first] = std::move(key_val.second);
     }
 
     return buff;
 }
 
+// Entries are decoded straight into the table, with no node allocated for each.
+template <id_table Table>
+InBuffer &operator>>(InBuffer &buff, Table &table) {
+    using U = typename Table::key_type;
+    using V = typename Table::mapped_type;
+    uint32_t table_size;
+    buff >> table_size;
+    table.clear();
+    while (table_size-- && buff.ok()) {
+        if constexpr (fixed_wire_size<std::pair<U, V>>) {
+            std::pair<U, V> key_val;
+            buff.read_fixed(key_val);
+            if (buff.ok())
+                table[key_val.first] = key_val.second;
+        } else {
+            U key;
+            buff >> key;
+            if (!buff.ok())
+                break;
+            buff >> table[key];
+            // A value cut short is not kept.
+            if (!buff.ok())
+                table.erase(key);
+        }
+    }
+
+    return buff;
+}
+
+// Decodes val from the start of a message, reporting malformed input instead of throwing.
+template <typename Buffer, typename T>
+DecodeError decode(Buffer &buff, T &val) {
+    buff.clear_error();
+    buff.begin_message();
+    buff >> val;
+    return buff.get_error();
+}
+
 #endif // __INBUFFERS_H__
\ No newline at end of file
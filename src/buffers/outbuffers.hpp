@@ -1,7 +1,11 @@
 #ifndef __OUTBUFFERS_H__
 #define __OUTBUFFERS_H__
 
-#include <boost/asio/detail/socket_ops.hpp>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/container/small_vector.hpp>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <exception>
 #include <variant>
@@ -9,9 +13,17 @@
 #include <list>
 #include <set>
 #include <map>
+#include <memory>
+#include <ranges>
+#include <vector>
 #include <iostream>
 
 #include "buffers_utils.hpp"
+#include "byteswap.hpp"
+#include "pool.hpp"
+#include "schema.hpp"
+#include "transports.hpp"
+#include "../id_table.hpp"
 #include "../utils.hpp"
 
 using boost::asio::ip::tcp;
@@ -19,76 +31,331 @@ using boost::asio::ip::udp;
 
 class OutBuffer {
 public:
+    // Socket operations gather at most this many buffers in one call.
+    static const size_t MAX_SEGMENTS = 64;
+
+    OutBuffer() {
+        segments.reserve(MAX_SEGMENTS);
+    }
+
     void send() {
         send_to_socket();
     }
 
     void write_data(const void *src, size_t n) {
-        if (size + n > CAPACITY) {
-            throw std::runtime_error("Not enough capacity.");
+        memcpy(claim(n), src, n);
+    }
+
+    // Encodes a fixed-size value with a single bounds check.
+    template <fixed_wire_size T>
+    void write_fixed(const T &val) {
+        store(claim(wire_size<T>()), val);
+    }
+
+    /* Appends n bytes without copying them - the send gathers them straight from src.
+     * The memory has to stay valid and unchanged until the next send().
+     * Short ranges are copied anyway, as is everything once the segment limit is hit.
+     * A reference takes up to two segments, and room is left for the data written after it. */
+    void write_ref(const void *src, size_t n) {
+        if (n < MIN_REF_SIZE || segments.size() + 3 > MAX_SEGMENTS) {
+            write_data(src, n);
+            return;
         }
 
-        memcpy(data + size, src, n);
-        size += n;
+        close_segment();
+        segments.push_back(boost::asio::const_buffer(src, n));
+        ref_size += n;
+    }
+
+    /* Encodes the elements one after another in host byte order
+     * and converts them all at once afterwards. */
+    template <typename Container>
+    void write_fixed_elements(const Container &container) {
+        using T = std::ranges::range_value_t<Container>;
+        constexpr size_t WORD = wire_word_size<T>();
+        char *start = claim(container.size() * wire_size<T>());
+        char *dest = start;
+        for (const T &val : container) {
+            dest = store<false>(dest, val);
+        }
+        if constexpr (std::endian::native == std::endian::little) {
+            byteswap_words<WORD>(start, start, (size_t) (dest - start) / WORD);
+        }
+    }
+
+    const char *get_data() { return data.get(); }
+
+    size_t get_memory_usage() { return data.size() + segments.capacity() * sizeof(boost::asio::const_buffer); }
+
+    // Gives grown storage back to the pool, once everything written was sent.
+    void trim() {
+        if (get_size() == 0 && data.size() > INITIAL_CAPACITY) {
+            data = PooledBlock(INITIAL_CAPACITY);
+        }
+    }
+
+    // Makes room for n more bytes up front, so that writing them does not reallocate.
+    void reserve(size_t n) {
+        if (size + n > data.size()) {
+            grow(size + n);
+        }
     }
 
-    const char *get_data() { return data; }
+    size_t get_size() { return size + ref_size; }
 
-    size_t get_size() { return size; }
+    // Buffer sequence covering everything written since the last send.
+    const std::vector<boost::asio::const_buffer> &get_buffers() {
+        close_segment();
+        return segments;
+    }
 
 protected:
     size_t size = 0;
-    static const size_t CAPACITY = 65536;
-    char data [CAPACITY];
+    static const size_t INITIAL_CAPACITY = BufferPool::MIN_BLOCK_SIZE;
+    PooledBlock data{INITIAL_CAPACITY};
+
+    void clear() {
+        size = 0;
+        segment_start = 0;
+        ref_size = 0;
+        segments.clear();
+    }
 
 private:
+    static const size_t MIN_REF_SIZE = 16;
+
+    size_t segment_start = 0;
+    size_t ref_size = 0;
+    std::vector<boost::asio::const_buffer> segments;
+
+    // Reserves n bytes at the end of the buffer.
+    char *claim(size_t n) {
+        reserve(n);
+        char *dest = data.get() + size;
+        size += n;
+        return dest;
+    }
+
+    // Trades the storage for a block of at least n bytes, moving the closed segments along.
+    void grow(size_t n) {
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data.get());
+        data.resize(n, size);
+        for (boost::asio::const_buffer &segment : segments) {
+            uintptr_t start = reinterpret_cast<uintptr_t>(segment.data());
+            if (start >= begin && start < begin + size) {
+                segment = boost::asio::const_buffer(data.get() + (start - begin), segment.size());
+            }
+        }
+    }
+
+    void close_segment() {
+        if (size > segment_start) {
+            segments.push_back(boost::asio::const_buffer(data.get() + segment_start, size - segment_start));
+            segment_start = size;
+        }
+    }
+
     virtual void send_to_socket() = 0;
 };
 
+// Collects the encoded bytes in memory, for recording messages or measuring them.
+class MemoryOutBuffer : public OutBuffer {
+public:
+    std::string take() {
+        std::string bytes;
+        take(bytes);
+        return bytes;
+    }
+
+    // Copies the encoded bytes into bytes, reusing its storage.
+    void take(std::string &bytes) {
+        bytes.resize(get_size());
+        boost::asio::buffer_copy(boost::asio::buffer(bytes), get_buffers());
+        clear();
+    }
+
+    void discard() {
+        clear();
+    }
+
+private:
+    virtual void send_to_socket() {}
+};
+
 class UDPOutBuffer : public OutBuffer {
 public:
-    UDPOutBuffer(udp::socket &socket, udp::endpoint endpoint) : socket(socket), endpoint(endpoint) {}
+    UDPOutBuffer(OutTransport &transport) : transport(transport) {}
 
 private:
-    udp::socket &socket;
-    udp::endpoint endpoint;
+    OutTransport &transport;
 
     virtual void send_to_socket() {
-        socket.send_to(boost::asio::buffer(data, size), endpoint);
-        size = 0;
+        transport.send(get_buffers());
+        clear();
     }
 };
 
+/* Besides sending directly, messages can be queued for a sender of their own, so that
+ * a slow server link never holds up the thread writing them. Whatever is queued while
+ * a write is under way goes out together in the next one. */
 class TCPOutBuffer : public OutBuffer {
 public:
-    TCPOutBuffer(tcp::socket &socket) : socket(socket) {}
+    // Bytes the queue holds at most, further messages are dropped until it drains.
+    static const size_t MAX_QUEUED = 1 << 16;
+
+    TCPOutBuffer(OutTransport &transport) : transport(transport) {}
+
+    /* Moves everything written since the last send to the queue. Returns false,
+     * dropping it, when the queue is full or a write has failed. A message that must
+     * not be dropped, a Join, is still queued past the limit. Only one is, all later
+     * ones would repeat it. */
+    bool queue(bool droppable = true) {
+        size_t n = get_size();
+        std::lock_guard lock(queue_mutex);
+        bool full = queued.size() + n > MAX_QUEUED;
+        if (failed || (full && (droppable || kept_past_limit))) {
+            dropped++;
+            clear();
+            return false;
+        }
+        kept_past_limit |= full;
+        size_t end = queued.size();
+        queued.resize(end + n);
+        boost::asio::buffer_copy(boost::asio::buffer(queued.data() + end, n), get_buffers());
+        clear();
+        queue_ready.notify_one();
+        return true;
+    }
+
+    /* Writes the queue out until close_queue(), taking all of it for each write.
+     * A transport that queues sends is flushed before waiting for more messages.
+     * A failed write is thrown, the queue drops everything from then on. */
+    void write_queue() {
+        std::unique_lock lock(queue_mutex);
+        for (;;) {
+            if (queued.empty()) {
+                write_unlocked(lock, [this]() { transport.flush(); });
+                queue_ready.wait(lock, [this]() { return !queued.empty() || closed; });
+                if (queued.empty()) {
+                    closed = false;
+                    return;
+                }
+            }
+            take_queue();
+            write_unlocked(lock, [this]() { transport.send({boost::asio::buffer(writing)}); });
+        }
+    }
+
+    // Ends write_queue() once what was queued before is written, it may be run again later.
+    void close_queue() {
+        {
+            std::lock_guard lock(queue_mutex);
+            closed = true;
+        }
+        queue_ready.notify_one();
+    }
+
+    /* For coroutines, which start a writer only while something is queued. Returns true
+     * if the caller is to run async_write_queue(), because none is running. */
+    bool claim_writer() {
+        std::lock_guard lock(queue_mutex);
+        if (writer_running || queued.empty())
+            return false;
+        writer_running = true;
+        return true;
+    }
+
+    // Coroutine counterpart of write_queue(), returning once the queue is empty.
+    boost::asio::awaitable<void> async_write_queue() {
+        for (;;) {
+            {
+                std::lock_guard lock(queue_mutex);
+                if (queued.empty()) {
+                    writer_running = false;
+                    co_return;
+                }
+                take_queue();
+            }
+            std::vector<boost::asio::const_buffer> buffers{boost::asio::buffer(writing)};
+            boost::system::error_code error;
+            try {
+                co_await transport.async_send(buffers);
+            } catch (boost::system::system_error &e) {
+                error = e.code();
+            }
+            if (error) {
+                std::lock_guard lock(queue_mutex);
+                fail(error);
+            }
+        }
+    }
+
+    size_t get_dropped() {
+        std::lock_guard lock(queue_mutex);
+        return dropped;
+    }
+
+    size_t get_queue_memory_usage() {
+        std::lock_guard lock(queue_mutex);
+        return queued.capacity() + writing.capacity();
+    }
 
 private:
-    tcp::socket &socket;
-    
-    virtual void send_to_socket() {
+    OutTransport &transport;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::string queued;
+    // Only touched by the writer, the bytes of the last write.
+    std::string writing;
+    size_t dropped = 0;
+    bool failed = false;
+    bool closed = false;
+    bool writer_running = false;
+    // Set once a message was queued past MAX_QUEUED, until the writer takes the queue.
+    bool kept_past_limit = false;
+
+    // Runs write with queue_mutex released, so that messages are queued meanwhile.
+    template <typename Write>
+    void write_unlocked(std::unique_lock<std::mutex> &lock, Write write) {
+        lock.unlock();
         boost::system::error_code error;
-        boost::asio::write(socket, boost::asio::buffer(data, size), error);
-        size = 0;
+        try {
+            write();
+        } catch (boost::system::system_error &e) {
+            error = e.code();
+        }
+        lock.lock();
+        if (error)
+            fail(error);
     }
-};
 
+    // Called with queue_mutex held.
+    void take_queue() {
+        writing.clear();
+        std::swap(queued, writing);
+        kept_past_limit = false;
+    }
 
-template <supported_integral T>
-T host_to_network(const T &val) {
-    if (sizeof(T) == 1) {
-        return val;
-    } else if (sizeof(T) == 2) {
-        return boost::asio::detail::socket_ops::host_to_network_short(val);
-    } else if (sizeof(T) == 4) {
-        return boost::asio::detail::socket_ops::host_to_network_long(val);
+    // Called with queue_mutex held.
+    void fail(const boost::system::error_code &error) {
+        failed = true;
+        writer_running = false;
+        dropped += !queued.empty();
+        queued.clear();
+        throw boost::system::system_error(error, "TCP write");
     }
-}
+
+    virtual void send_to_socket() {
+        transport.send(get_buffers());
+        clear();
+    }
+};
+
 
 template <supported_integral T>
 OutBuffer &operator<<(OutBuffer &buff, const T &val) {
-    T network_val = host_to_network(val);
-    buff.write_data(&network_val, sizeof(network_val));
+    buff.write_fixed(val);
     return buff;
 }
 
@@ -102,6 +369,21 @@ OutBuffer &operator<<(OutBuffer &buff, const std::string &val) {
     return buff;
 }
 
+// String which stays alive and unchanged until the buffer is sent, so it is not copied.
+struct StringRef {
+    const std::string &str;
+};
+
+OutBuffer &operator<<(OutBuffer &buff, const StringRef &val) {
+    if (val.str.size() > std::numeric_limits<uint8_t>::max()) {
+        throw std::runtime_error("String too long.");
+    }
+
+    buff << (uint8_t) val.str.size();
+    buff.write_ref(val.str.c_str(), val.str.size());
+    return buff;
+}
+
 template <class... Ts>
 OutBuffer &operator<<(OutBuffer &buff, const std::variant<Ts...> &variant) {
         uint8_t index = (uint8_t) variant.index();
@@ -111,24 +393,49 @@ OutBuffer &operator<<(OutBuffer &buff, const std::variant<Ts...> &variant) {
 
 template <typename U, typename V>
 OutBuffer &operator<<(OutBuffer &buff, const std::pair<U, V> &pair) {
-    buff << pair.first << pair.second;
+    if constexpr (fixed_wire_size<std::pair<U, V>>) {
+        buff.write_fixed(pair);
+    } else {
+        buff << pair.first << pair.second;
+    }
     return buff;
 }
 
-template <typename T>
-OutBuffer &operator<<(OutBuffer &buff, const std::list<T> &list) {
+// A list, vector or small_vector goes on the wire the same way.
+template <typename Container>
+OutBuffer &write_list(OutBuffer &buff, const Container &list) {
+    using T = typename Container::value_type;
     if (list.size() > std::numeric_limits<uint32_t>::max()) {
         throw std::runtime_error("List too long.");
     }
 
     buff << static_cast<uint32_t>(list.size());
-    for (const T &val : list) {
-        buff << val;
+    if constexpr (bulk_swappable<T>) {
+        buff.write_fixed_elements(list);
+    } else {
+        for (const T &val : list) {
+            buff << val;
+        }
     }
 
     return buff;
 }
 
+template <typename T>
+OutBuffer &operator<<(OutBuffer &buff, const std::list<T> &list) {
+    return write_list(buff, list);
+}
+
+template <typename T>
+OutBuffer &operator<<(OutBuffer &buff, const std::vector<T> &vector) {
+    return write_list(buff, vector);
+}
+
+template <typename T, size_t N>
+OutBuffer &operator<<(OutBuffer &buff, const boost::container::small_vector<T, N> &vector) {
+    return write_list(buff, vector);
+}
+
 template <typename T>
 OutBuffer &operator<<(OutBuffer &buff, const std::set<T> &set) {
     if (set.size() > std::numeric_limits<uint32_t>::max()) {
@@ -136,8 +443,12 @@ OutBuffer &operator<<(OutBuffer &buff, const std::set<T> &set) {
     }
 
     buff << static_cast<uint32_t>(set.size());
-    for (const T &val : set) {
-        buff << val;
+    if constexpr (bulk_swappable<T>) {
+        buff.write_fixed_elements(set);
+    } else {
+        for (const T &val : set) {
+            buff << val;
+        }
     }
 
     return buff;
@@ -150,10 +461,121 @@ OutBuffer &operator<<(OutBuffer &buff, const std::map<U, V> &map) {
     }
 
     buff << static_cast<uint32_t>(map.size());
-    for (const std::pair<U, V> &key_val : map) {
-        buff << key_val;
+    if constexpr (bulk_swappable<std::pair<const U, V>>) {
+        buff.write_fixed_elements(map);
+    } else {
+        for (const std::pair<const U, V> &key_val : map) {
+            buff << key_val;
+        }
     }
     return buff;
 }
 
+template <id_table Table>
+OutBuffer &operator<<(OutBuffer &buff, const Table &table) {
+    buff << static_cast<uint32_t>(table.size());
+    if constexpr (bulk_swappable<typename Table::value_type>) {
+        buff.write_fixed_elements(table);
+    } else {
+        for (const typename Table::value_type &key_val : table) {
+            buff << key_val;
+        }
+    }
+    return buff;
+}
+
+/* Encoding of values which rarely change, made once and written by reference into
+ * every message that contains them until the values change and it is redone. */
+class EncodedFragment {
+public:
+    template <typename... Ts>
+    void assign(const Ts &...vals) {
+        MemoryOutBuffer buff;
+        (buff << ... << vals);
+        bytes = buff.take();
+    }
+
+private:
+    std::string bytes;
+
+    friend OutBuffer &operator<<(OutBuffer &buff, const EncodedFragment &fragment) {
+        buff.write_ref(fragment.bytes.data(), fragment.bytes.size());
+        return buff;
+    }
+
+    friend size_t encoded_size(const EncodedFragment &fragment) {
+        return fragment.bytes.size();
+    }
+};
+
+/* Exact number of bytes operator<< writes for a value, so that a message can be
+ * sized before it is encoded. Message classes provide their own overloads. */
+template <fixed_wire_size T>
+constexpr size_t encoded_size(const T &) {
+    return wire_size<T>();
+}
+
+size_t encoded_size(const std::string &val) {
+    return 1 + val.size();
+}
+
+size_t encoded_size(const StringRef &val) {
+    return 1 + val.str.size();
+}
+
+template <class... Ts>
+size_t encoded_size(const std::variant<Ts...> &variant) {
+    return 1 + std::visit([](auto const &value){ return encoded_size(value); }, variant);
+}
+
+template <typename U, typename V>
+size_t encoded_size(const std::pair<U, V> &pair) {
+    return encoded_size(pair.first) + encoded_size(pair.second);
+}
+
+// Size of a list, set or map.
+template <typename Container>
+size_t encoded_elements_size(const Container &container) {
+    using T = std::ranges::range_value_t<Container>;
+    size_t size = sizeof(uint32_t);
+    if constexpr (fixed_wire_size<T>) {
+        size += container.size() * wire_size<T>();
+    } else {
+        for (const T &val : container) {
+            size += encoded_size(val);
+        }
+    }
+    return size;
+}
+
+template <typename T>
+size_t encoded_size(const std::list<T> &list) {
+    return encoded_elements_size(list);
+}
+
+template <typename T>
+size_t encoded_size(const std::vector<T> &vector) {
+    return encoded_elements_size(vector);
+}
+
+template <typename T, size_t N>
+size_t encoded_size(const boost::container::small_vector<T, N> &vector) {
+    return encoded_elements_size(vector);
+}
+
+template <typename T>
+size_t encoded_size(const std::set<T> &set) {
+    return encoded_elements_size(set);
+}
+
+template <typename U, typename V>
+size_t encoded_size(const std::map<U, V> &map) {
+    return encoded_elements_size(map);
+}
+
+template <id_table Table>
+size_t encoded_size(const Table &table) {
+    return encoded_elements_size(table);
+}
+
 #endif // __OUTBUFFERS_H__
\ No newline at end of file
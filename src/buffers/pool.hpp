@@ -0,0 +1,131 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/* Process-wide free lists of power-of-two blocks shared by the buffers of all
+ * sessions. A buffer starts with a small block and trades it for a bigger one
+ * only when a message needs it, so idle sessions stay small and big blocks
+ * are reused instead of being kept by every session. */
+class BufferPool {
+public:
+    static const size_t MIN_BLOCK_SIZE = 512;
+    // Bigger blocks are allocated and freed directly.
+    static const size_t MAX_BLOCK_SIZE = 4 << 20;
+    static const size_t MAX_FREE_BLOCKS = 8;
+
+    BufferPool(const BufferPool &) = delete;
+
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    ~BufferPool() {
+        for (std::vector<char *> &blocks : free_blocks) {
+            for (char *block : blocks)
+                delete[] block;
+        }
+    }
+
+    static BufferPool &instance() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    static size_t block_size(size_t n) {
+        size_t size = MIN_BLOCK_SIZE;
+        while (size < n)
+            size *= 2;
+        return size;
+    }
+
+    // Returns a block of block_size(n) bytes.
+    char *acquire(size_t n) {
+        size_t size = block_size(n);
+        if (size <= MAX_BLOCK_SIZE) {
+            std::lock_guard lock(mutex);
+            std::vector<char *> &blocks = free_blocks[size_class(size)];
+            if (!blocks.empty()) {
+                char *block = blocks.back();
+                blocks.pop_back();
+                return block;
+            }
+        }
+        return new char[size];
+    }
+
+    void release(char *block, size_t size) {
+        if (size <= MAX_BLOCK_SIZE) {
+            std::lock_guard lock(mutex);
+            std::vector<char *> &blocks = free_blocks[size_class(size)];
+            if (blocks.size() < MAX_FREE_BLOCKS) {
+                blocks.push_back(block);
+                return;
+            }
+        }
+        delete[] block;
+    }
+
+private:
+    static const size_t CLASSES = 14; // MIN_BLOCK_SIZE << 13 == MAX_BLOCK_SIZE
+
+    std::mutex mutex;
+    std::vector<char *> free_blocks[CLASSES];
+
+    BufferPool() = default;
+
+    static size_t size_class(size_t size) {
+        size_t size_class = 0;
+        while ((MIN_BLOCK_SIZE << size_class) < size)
+            size_class++;
+        return size_class;
+    }
+};
+
+// Block from the pool owned by a single buffer.
+class PooledBlock {
+public:
+    PooledBlock(size_t n)
+    : block(BufferPool::instance().acquire(n)), block_size(BufferPool::block_size(n)) {}
+
+    PooledBlock(PooledBlock &&other)
+    : block(std::exchange(other.block, nullptr)), block_size(std::exchange(other.block_size, 0)) {}
+
+    PooledBlock &operator=(PooledBlock &&other) {
+        if (this != &other) {
+            reset();
+            block = std::exchange(other.block, nullptr);
+            block_size = std::exchange(other.block_size, 0);
+        }
+        return *this;
+    }
+
+    ~PooledBlock() {
+        reset();
+    }
+
+    char *get() const { return block; }
+
+    size_t size() const { return block_size; }
+
+    // Trades the block for one of at least n bytes, keeping the first keep bytes.
+    void resize(size_t n, size_t keep) {
+        PooledBlock resized(n);
+        memcpy(resized.get(), block, keep);
+        *this = std::move(resized);
+    }
+
+private:
+    char *block;
+    size_t block_size;
+
+    void reset() {
+        if (block != nullptr)
+            BufferPool::instance().release(block, block_size);
+        block = nullptr;
+    }
+};
+
+#endif // __POOL_H__
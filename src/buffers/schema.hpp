@@ -0,0 +1,235 @@
+#ifndef __SCHEMA_H__
+#define __SCHEMA_H__
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "buffers_utils.hpp"
+
+/* Fixed-size structs list their fields in wire order as
+ *     static constexpr auto wire_fields() { return std::tuple{&T::a, &T::b}; }
+ * so their wire size is known at compile time and they are encoded with a single
+ * bounds check, field by field straight into the buffer. */
+
+template <supported_integral T>
+constexpr T byteswap(T val) {
+    if constexpr (sizeof(T) == 1)
+        return val;
+    else if constexpr (sizeof(T) == 2)
+        return (T) __builtin_bswap16((uint16_t) val);
+    else
+        return (T) __builtin_bswap32((uint32_t) val);
+}
+
+// The protocol is big-endian.
+template <supported_integral T>
+constexpr T host_to_network(T val) {
+    if constexpr (std::endian::native == std::endian::little)
+        return byteswap(val);
+    else
+        return val;
+}
+
+template <supported_integral T>
+constexpr T network_to_host(T val) {
+    return host_to_network(val);
+}
+
+template <typename T>
+struct member_type;
+
+template <typename C, typename T>
+struct member_type<T C::*> {
+    using type = T;
+};
+
+template <typename T>
+struct is_pair : std::false_type {};
+
+template <typename U, typename V>
+struct is_pair<std::pair<U, V>> : std::true_type {};
+
+template <typename T>
+concept wire_struct = requires { T::wire_fields(); };
+
+template <typename T>
+constexpr bool is_fixed_wire_size() {
+    using U = std::remove_const_t<T>;
+    if constexpr (supported_integral<U> || std::is_enum_v<U> || wire_struct<U>)
+        return true;
+    else if constexpr (is_pair<U>::value)
+        return is_fixed_wire_size<typename U::first_type>() && is_fixed_wire_size<typename U::second_type>();
+    else
+        return false;
+}
+
+template <typename T>
+concept fixed_wire_size = is_fixed_wire_size<T>();
+
+template <fixed_wire_size T>
+constexpr size_t wire_size() {
+    using U = std::remove_const_t<T>;
+    if constexpr (std::is_enum_v<U>)
+        return sizeof(std::underlying_type_t<U>);
+    else if constexpr (is_pair<U>::value)
+        return wire_size<typename U::first_type>() + wire_size<typename U::second_type>();
+    else if constexpr (wire_struct<U>)
+        return std::apply([](auto... fields) {
+            return (wire_size<typename member_type<decltype(fields)>::type>() + ... + 0);
+        }, U::wire_fields());
+    else
+        return sizeof(U);
+}
+
+/* Size of every integer T is made of, or 0 if they differ. Arrays of such
+ * values are byte-swapped in bulk, see byteswap.hpp. */
+template <fixed_wire_size T>
+constexpr size_t wire_word_size() {
+    using U = std::remove_const_t<T>;
+    if constexpr (std::is_enum_v<U>) {
+        return sizeof(std::underlying_type_t<U>);
+    } else if constexpr (is_pair<U>::value) {
+        constexpr size_t first = wire_word_size<typename U::first_type>();
+        constexpr size_t second = wire_word_size<typename U::second_type>();
+        return first == second ? first : 0;
+    } else if constexpr (wire_struct<U>) {
+        return std::apply([](auto... fields) {
+            size_t sizes[] = {wire_word_size<typename member_type<decltype(fields)>::type>()...};
+            for (size_t size : sizes) {
+                if (size != sizes[0])
+                    return (size_t) 0;
+            }
+            return sizes[0];
+        }, U::wire_fields());
+    } else {
+        return sizeof(U);
+    }
+}
+
+template <typename T>
+concept bulk_swappable = fixed_wire_size<T> && wire_word_size<T>() > 0;
+
+/* Encodes val at dest, which has room for wire_size<T>() bytes. Returns the end of it.
+ * With SWAP unset the integers are left in host byte order. */
+template <bool SWAP = true, fixed_wire_size T>
+char *store(char *dest, const T &val) {
+    if constexpr (std::is_enum_v<T>) {
+        return store<SWAP>(dest, static_cast<std::underlying_type_t<T>>(val));
+    } else if constexpr (is_pair<T>::value) {
+        return store<SWAP>(store<SWAP>(dest, val.first), val.second);
+    } else if constexpr (wire_struct<T>) {
+        std::apply([&dest, &val](auto... fields) { ((dest = store<SWAP>(dest, val.*fields)), ...); },
+                   T::wire_fields());
+        return dest;
+    } else {
+        T network_val = SWAP ? host_to_network(val) : val;
+        memcpy(dest, &network_val, sizeof(T));
+        return dest + sizeof(T);
+    }
+}
+
+// Decodes val from src, which holds wire_size<T>() bytes. Returns the end of them.
+template <bool SWAP = true, fixed_wire_size T>
+const char *load(const char *src, T &val) {
+    if constexpr (std::is_enum_v<T>) {
+        std::underlying_type_t<T> underlying;
+        src = load<SWAP>(src, underlying);
+        val = static_cast<T>(underlying);
+        return src;
+    } else if constexpr (is_pair<T>::value) {
+        return load<SWAP>(load<SWAP>(src, val.first), val.second);
+    } else if constexpr (wire_struct<T>) {
+        std::apply([&src, &val](auto... fields) { ((src = load<SWAP>(src, val.*fields)), ...); },
+                   T::wire_fields());
+        return src;
+    } else {
+        T network_val;
+        memcpy(&network_val, src, sizeof(T));
+        val = SWAP ? network_to_host(network_val) : network_val;
+        return src + sizeof(T);
+    }
+}
+
+/* Decodes the alternative with the given index from src, which has been checked
+ * to hold it. Alternatives which are not fixed-size provide their own load. */
+template <class V>
+const char *load_alternative(const char *src, uint8_t index, V &variant) {
+    static constexpr auto loaders = []<std::size_t... Is>(std::index_sequence<Is...>) {
+        return std::array<const char *(*)(const char *, V &), sizeof...(Is)>{
+            [](const char *src, V &variant) { return load(src, variant.template emplace<Is>()); }...
+        };
+    }(std::make_index_sequence<std::variant_size_v<V>>());
+    return loaders[index](src, variant);
+}
+
+/* List of fixed-size values still in wire format, each decoded when it is iterated over.
+ * The bytes have to outlive the view. */
+template <fixed_wire_size T>
+class WireListView {
+public:
+    using value_type = T;
+
+    class iterator {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = T;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() = default;
+
+        iterator(const char *src) : src(src) {}
+
+        T operator*() const {
+            T val;
+            load(src, val);
+            return val;
+        }
+
+        iterator &operator++() {
+            src += wire_size<T>();
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const { return src == other.src; }
+
+    private:
+        const char *src = nullptr;
+    };
+
+    using const_iterator = iterator;
+
+    WireListView() = default;
+
+    WireListView(const char *data, size_t count) : data(data), count(count) {}
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    iterator begin() const { return iterator(data); }
+
+    iterator end() const { return iterator(get_end()); }
+
+    // First byte after the list.
+    const char *get_end() const { return data + count * wire_size<T>(); }
+
+private:
+    const char *data = nullptr;
+    size_t count = 0;
+};
+
+#endif // __SCHEMA_H__
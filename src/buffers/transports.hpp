@@ -0,0 +1,476 @@
+#ifndef __TRANSPORTS_H__
+#define __TRANSPORTS_H__
+
+#include <utility>
+#include <boost/asio.hpp>
+#include <sys/socket.h>
+#include <poll.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "uring.hpp"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+/* Moves bytes from a socket into the input buffers. For a stream receive returns
+ * whatever is available, for datagrams one whole datagram. Blocks until something arrives. */
+class InTransport {
+public:
+    virtual ~InTransport() = default;
+
+    virtual size_t receive(void *dest, size_t n) = 0;
+
+    // Number of received chunks or datagrams that receive() returns without blocking.
+    virtual size_t pending() { return 0; }
+
+    // Bytes of memory the transport holds on to.
+    virtual size_t get_memory_usage() = 0;
+};
+
+// Sends the contents of an output buffer as one message.
+class OutTransport {
+public:
+    virtual ~OutTransport() = default;
+
+    virtual void send(const std::vector<boost::asio::const_buffer> &buffers) = 0;
+
+    /* Returns once everything sent so far is written, throwing if it failed. Only
+     * transports that queue sends have anything to wait for. */
+    virtual void flush() {}
+
+    // For coroutines, by default the same as send() and flush().
+    virtual boost::asio::awaitable<void> async_send(std::vector<boost::asio::const_buffer> buffers) {
+        send(buffers);
+        flush();
+        co_return;
+    }
+
+    virtual size_t get_memory_usage() = 0;
+};
+
+/**************** asio sockets ****************/
+
+template <typename Socket>
+class AsioInTransport : public InTransport {
+public:
+    AsioInTransport(Socket &socket) : socket(socket) {}
+
+    virtual size_t receive(void *dest, size_t n) {
+        return socket.receive(boost::asio::buffer(dest, n));
+    }
+
+    // The kernel does not say how many chunks it has, only whether there is anything.
+    virtual size_t pending() { return socket.available() > 0; }
+
+    virtual size_t get_memory_usage() { return sizeof(*this); }
+
+private:
+    Socket &socket;
+};
+
+class AsioTCPOutTransport : public OutTransport {
+public:
+    AsioTCPOutTransport(tcp::socket &socket) : socket(socket) {}
+
+    // Throws when the write fails.
+    virtual void send(const std::vector<boost::asio::const_buffer> &buffers) {
+        boost::asio::write(socket, buffers);
+    }
+
+    virtual boost::asio::awaitable<void> async_send(std::vector<boost::asio::const_buffer> buffers) {
+        co_await boost::asio::async_write(socket, buffers, boost::asio::use_awaitable);
+    }
+
+    virtual size_t get_memory_usage() { return sizeof(*this); }
+
+private:
+    tcp::socket &socket;
+};
+
+/**************** recvmmsg / sendmmsg ****************/
+
+// Waits until the socket is ready, for sockets asio switched to non-blocking mode.
+void wait_for_socket(int fd, short events) {
+    pollfd poll_fd{fd, events, 0};
+    while (poll(&poll_fd, 1, -1) < 0 && errno == EINTR) {}
+}
+
+/* Drains up to BATCH datagrams per recvmmsg. Datagrams longer than DATAGRAM_SIZE
+ * are truncated, which is fine as no valid GUI message comes close to it. */
+class MmsgUDPInTransport : public InTransport {
+public:
+    MmsgUDPInTransport(udp::socket &socket) : fd(socket.native_handle()) {
+        for (size_t i = 0; i < BATCH; i++) {
+            iovecs[i] = iovec{datagrams[i], DATAGRAM_SIZE};
+            messages[i].msg_hdr = msghdr{};
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    virtual size_t receive(void *dest, size_t n) {
+        if (next == received) {
+            receive_batch();
+        }
+
+        size_t copied = std::min(n, (size_t) messages[next].msg_len);
+        memcpy(dest, datagrams[next], copied);
+        next++;
+        return copied;
+    }
+
+    virtual size_t pending() { return received - next; }
+
+    virtual size_t get_memory_usage() { return sizeof(*this); }
+
+private:
+    static const size_t BATCH = 32;
+    static const size_t DATAGRAM_SIZE = 32;
+
+    int fd;
+    char datagrams[BATCH][DATAGRAM_SIZE];
+    iovec iovecs[BATCH];
+    mmsghdr messages[BATCH];
+    size_t received = 0;
+    size_t next = 0;
+
+    void receive_batch() {
+        for (;;) {
+            int ret = recvmmsg(fd, messages, BATCH, MSG_WAITFORONE, nullptr);
+            if (ret > 0) {
+                received = (size_t) ret;
+                next = 0;
+                return;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_for_socket(fd, POLLIN);
+            } else if (errno != EINTR) {
+                throw boost::system::system_error(errno, boost::system::system_category());
+            }
+        }
+    }
+};
+
+// Sends each message to every endpoint with a single sendmmsg.
+class MmsgUDPOutTransport : public OutTransport {
+public:
+    MmsgUDPOutTransport(udp::socket &socket, std::vector<udp::endpoint> endpoints)
+    : fd(socket.native_handle()), endpoints(endpoints), messages(endpoints.size()) {}
+
+    virtual void send(const std::vector<boost::asio::const_buffer> &buffers) {
+        iovecs.clear();
+        for (const boost::asio::const_buffer &buffer : buffers) {
+            iovecs.push_back(iovec{const_cast<void *>(buffer.data()), buffer.size()});
+        }
+        for (size_t i = 0; i < endpoints.size(); i++) {
+            messages[i].msg_hdr = msghdr{};
+            messages[i].msg_hdr.msg_name = endpoints[i].data();
+            messages[i].msg_hdr.msg_namelen = (socklen_t) endpoints[i].size();
+            messages[i].msg_hdr.msg_iov = iovecs.data();
+            messages[i].msg_hdr.msg_iovlen = iovecs.size();
+        }
+
+        size_t sent = 0;
+        while (sent < messages.size()) {
+            int ret = sendmmsg(fd, messages.data() + sent, (unsigned) (messages.size() - sent), 0);
+            if (ret >= 0) {
+                sent += (size_t) ret;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_for_socket(fd, POLLOUT);
+            } else if (errno != EINTR) {
+                throw boost::system::system_error(errno, boost::system::system_category());
+            }
+        }
+    }
+
+    virtual size_t get_memory_usage() {
+        return sizeof(*this) + endpoints.capacity() * sizeof(udp::endpoint)
+             + messages.capacity() * sizeof(mmsghdr) + iovecs.capacity() * sizeof(iovec);
+    }
+
+private:
+    int fd;
+    std::vector<udp::endpoint> endpoints;
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iovecs;
+};
+
+/**************** io_uring ****************/
+
+/* Keeps a multishot receive posted on the socket, so the kernel fills
+ * provided buffers without a system call per receive. */
+class UringInTransport : public InTransport, private UringOperation {
+public:
+    UringInTransport(Uring &ring, int fd, bool stream, size_t buffer_size, uint16_t buffer_count)
+    : ring(ring), fd(fd), stream(stream), buffers(ring, buffer_size, buffer_count) {}
+
+    virtual size_t receive(void *dest, size_t n) {
+        if (armed && armed_by != std::this_thread::get_id())
+            cancel();
+
+        while (chunks.empty()) {
+            if (error)
+                throw boost::system::system_error(error);
+            if (!armed)
+                arm();
+            ring.wait();
+        }
+
+        Chunk &chunk = chunks.front();
+        size_t copied = std::min(n, chunk.size - chunk.offset);
+        memcpy(dest, buffers.get(chunk.buffer_id) + chunk.offset, copied);
+        chunk.offset += copied;
+        if (!stream || chunk.offset == chunk.size) {
+            buffers.recycle(chunk.buffer_id);
+            chunks.pop_front();
+        }
+        return copied;
+    }
+
+    virtual size_t pending() { return chunks.size(); }
+
+    virtual size_t get_memory_usage() { return sizeof(*this) + buffers.get_memory_usage(); }
+
+private:
+    struct Chunk {
+        uint16_t buffer_id;
+        size_t size;
+        size_t offset;
+    };
+
+    Uring &ring;
+    int fd;
+    bool stream;
+    bool multishot = true;
+    bool armed = false;
+    std::thread::id armed_by;
+    UringBufferGroup buffers;
+    std::deque<Chunk> chunks;
+    boost::system::error_code error;
+
+    void arm() {
+        io_uring_sqe *sqe = ring.get_sqe(this, false);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffers.get_group_id();
+        sqe->ioprio = multishot ? IORING_RECV_MULTISHOT : 0;
+        armed = true;
+        armed_by = std::this_thread::get_id();
+    }
+
+    /* The kernel completes a receive on the thread that submitted it and cancels it
+     * once that thread exits, so a new receiving thread takes the receive over.
+     * Waits for the old one to finish, so that the stream stays in order. */
+    void cancel() {
+        io_uring_sqe *sqe = ring.get_sqe(nullptr, false);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<uint64_t>(static_cast<UringOperation *>(this));
+        while (armed)
+            ring.wait();
+    }
+
+    virtual void complete(int32_t res, uint32_t flags) {
+        if (!(flags & IORING_CQE_F_MORE))
+            armed = false;
+
+        if (res >= 0 && (flags & IORING_CQE_F_BUFFER)) {
+            if (res == 0 && stream) {
+                buffers.recycle((uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT));
+                error = boost::asio::error::eof;
+            } else {
+                chunks.push_back(Chunk{(uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT), (size_t) res, 0});
+            }
+        } else if (res == 0 && stream) {
+            error = boost::asio::error::eof;
+        } else if (res == -ECANCELED) {
+            // rearmed on the next receive
+        } else if (res == -EINVAL && multishot) {
+            multishot = false; // kernel older than 6.0, fall back to rearming after each receive
+        } else if (res < 0 && res != -ENOBUFS) {
+            error = boost::system::error_code(-res, boost::system::system_category());
+        }
+    }
+};
+
+/* Copies each message into a send slot and queues it on the ring. It goes to the
+ * kernel with the ring's next wait or submit, so a thread that does not wait on
+ * the ring after sending has to submit itself. On a stream only one send is in
+ * flight at a time, the others wait in order, so that the bytes are not reordered. */
+class UringOutTransport : public OutTransport {
+public:
+    UringOutTransport(Uring &ring, int fd, bool stream) : ring(ring), fd(fd), stream(stream) {
+        for (SendSlot &slot : slots)
+            slot.transport = this;
+    }
+
+    UringOutTransport(Uring &ring, int fd, const std::vector<udp::endpoint> &endpoints)
+    : UringOutTransport(ring, fd, false) {
+        destinations = endpoints;
+    }
+
+    // Throws if an earlier send on the stream failed.
+    virtual void send(const std::vector<boost::asio::const_buffer> &buffers) {
+        if (error)
+            throw boost::system::system_error(error);
+        SendSlot *slot = free_slot();
+        slot->data.resize(boost::asio::buffer_size(buffers));
+        boost::asio::buffer_copy(boost::asio::buffer(slot->data), buffers);
+        slot->sent = 0;
+        slot->busy = true;
+        if (stream && stream_sending)
+            waiting.push_back(slot);
+        else
+            queue(*slot);
+    }
+
+    virtual void flush() {
+        while (std::any_of(std::begin(slots), std::end(slots), [](SendSlot &slot) { return slot.busy; }))
+            ring.wait(0);
+        if (error)
+            throw boost::system::system_error(error);
+    }
+
+    virtual size_t get_memory_usage() {
+        size_t usage = sizeof(*this) + destinations.capacity() * sizeof(udp::endpoint);
+        for (SendSlot &slot : slots)
+            usage += slot.data.capacity() + slot.messages.capacity() * sizeof(msghdr);
+        return usage;
+    }
+
+private:
+    struct SendSlot : public UringOperation {
+        UringOutTransport *transport;
+        std::vector<char> data;
+        size_t sent;
+        size_t in_flight;
+        bool busy = false;
+        iovec iov;
+        std::vector<msghdr> messages;
+
+        virtual void complete(int32_t res, [[maybe_unused]] uint32_t flags) {
+            transport->completed(*this, res);
+        }
+    };
+
+    static const size_t SLOTS = 4;
+
+    Uring &ring;
+    int fd;
+    bool stream;
+    std::vector<udp::endpoint> destinations;
+    SendSlot slots[SLOTS];
+    bool stream_sending = false;
+    std::deque<SendSlot *> waiting;
+    boost::system::error_code error;
+
+    SendSlot *free_slot() {
+        for (;;) {
+            for (SendSlot &slot : slots) {
+                if (!slot.busy)
+                    return &slot;
+            }
+            ring.wait(0);
+        }
+    }
+
+    void queue(SendSlot &slot) {
+        if (stream) {
+            io_uring_sqe *sqe = ring.get_sqe(&slot, true);
+            sqe->fd = fd;
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = reinterpret_cast<uint64_t>(slot.data.data() + slot.sent);
+            sqe->len = (uint32_t) (slot.data.size() - slot.sent);
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            slot.in_flight = 1;
+            stream_sending = true;
+            return;
+        }
+
+        slot.iov = iovec{slot.data.data(), slot.data.size()};
+        slot.messages.resize(destinations.size());
+        slot.in_flight = destinations.size();
+        for (size_t i = 0; i < destinations.size(); i++) {
+            msghdr &message = slot.messages[i];
+            message = msghdr{};
+            message.msg_name = destinations[i].data();
+            message.msg_namelen = (socklen_t) destinations[i].size();
+            message.msg_iov = &slot.iov;
+            message.msg_iovlen = 1;
+            io_uring_sqe *sqe = ring.get_sqe(&slot, true);
+            sqe->fd = fd;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->addr = reinterpret_cast<uint64_t>(&message);
+            sqe->len = 1;
+        }
+    }
+
+    /* Failed datagrams are dropped. A failed stream send drops the sends waiting
+     * behind it and is thrown by the next send(). */
+    void completed(SendSlot &slot, int32_t res) {
+        if (!stream) {
+            if (--slot.in_flight == 0)
+                slot.busy = false;
+            return;
+        }
+
+        if (res < 0) {
+            error = boost::system::error_code(-res, boost::system::system_category());
+            for (SendSlot *waiting_slot : waiting)
+                waiting_slot->busy = false;
+            waiting.clear();
+        } else if (slot.sent + (size_t) res < slot.data.size()) {
+            slot.sent += (size_t) res;
+            queue(slot);
+            return;
+        }
+        slot.busy = false;
+        stream_sending = false;
+        if (!waiting.empty()) {
+            SendSlot *next = waiting.front();
+            waiting.pop_front();
+            queue(*next);
+        }
+    }
+};
+
+/**************** Choosing the transport ****************/
+
+/* Each uses io_uring on the given ring, or plain sockets when there is no ring
+ * or the kernel lacks the features needed. */
+std::unique_ptr<InTransport> make_in_transport(tcp::socket &socket, Uring *ring) {
+    if (ring) {
+        try {
+            return std::make_unique<UringInTransport>(*ring, socket.native_handle(), true, 4096, 8);
+        } catch (std::system_error &) {}
+    }
+    return std::make_unique<AsioInTransport<tcp::socket>>(socket);
+}
+
+std::unique_ptr<InTransport> make_in_transport(udp::socket &socket, Uring *ring) {
+    if (ring) {
+        try {
+            return std::make_unique<UringInTransport>(*ring, socket.native_handle(), false, 64, 32);
+        } catch (std::system_error &) {}
+    }
+    return std::make_unique<MmsgUDPInTransport>(socket);
+}
+
+std::unique_ptr<OutTransport> make_out_transport(tcp::socket &socket, Uring *ring) {
+    if (ring)
+        return std::make_unique<UringOutTransport>(*ring, socket.native_handle(), true);
+    return std::make_unique<AsioTCPOutTransport>(socket);
+}
+
+std::unique_ptr<OutTransport> make_out_transport(udp::socket &socket, const std::vector<udp::endpoint> &endpoints,
+                                                 Uring *ring) {
+    if (ring)
+        return std::make_unique<UringOutTransport>(*ring, socket.native_handle(), endpoints);
+    return std::make_unique<MmsgUDPOutTransport>(socket, endpoints);
+}
+
+#endif // __TRANSPORTS_H__
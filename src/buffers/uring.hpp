@@ -0,0 +1,255 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+// Something waiting for io_uring completions.
+class UringOperation {
+public:
+    virtual ~UringOperation() = default;
+
+    virtual void complete(int32_t res, uint32_t flags) = 0;
+};
+
+/* Minimal io_uring instance driven by a single thread at a time.
+ * Submissions are only queued and go to the kernel with the next wait or submit(),
+ * so a send followed by waiting on the same ring costs one system call. */
+class Uring {
+public:
+    ~Uring() {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_size);
+        if (sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_size);
+        close(fd);
+    }
+
+    Uring(const Uring &) = delete;
+
+    Uring &operator=(const Uring &) = delete;
+
+    // Returns nullptr when io_uring is not available.
+    static std::unique_ptr<Uring> create(unsigned entries = 64) {
+        io_uring_params params{};
+        int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return nullptr;
+
+        std::unique_ptr<Uring> ring(new Uring(fd));
+        if (!ring->map(params) || !ring->supports({IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SENDMSG}))
+            return nullptr;
+        return ring;
+    }
+
+    int get_fd() { return fd; }
+
+    uint16_t allocate_group_id() { return next_group_id++; }
+
+    /* Queues a new entry completing to op, or to nothing if op is null. Entries with
+     * counted set produce exactly one completion, which wait() collects before returning. */
+    io_uring_sqe *get_sqe(UringOperation *op, bool counted) {
+        if (sq_local_tail - std::atomic_ref(*sq_head).load(std::memory_order_acquire) == sq_entries)
+            enter(0, 0);
+
+        io_uring_sqe *sqe = &sqes[sq_local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->user_data = reinterpret_cast<uint64_t>(op) | (counted ? 1 : 0);
+        sq_local_tail++;
+        owed += counted;
+        return sqe;
+    }
+
+    // Hands the queued entries to the kernel without waiting.
+    void submit() {
+        enter(0, 0);
+    }
+
+    /* Submits the queued entries and waits until all counted operations
+     * complete and at least extra other completions arrive. */
+    void wait(unsigned extra = 1) {
+        enter(owed + extra, IORING_ENTER_GETEVENTS);
+    }
+
+private:
+    int fd;
+    void *sq_ptr = MAP_FAILED;
+    void *cq_ptr = MAP_FAILED;
+    io_uring_sqe *sqes = (io_uring_sqe *) MAP_FAILED;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail = 0;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+
+    unsigned owed = 0;
+    uint16_t next_group_id = 0;
+
+    Uring(int fd) : fd(fd) {}
+
+    template <typename T>
+    T *at(void *base, uint32_t offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    bool map(const io_uring_params &params) {
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+            return false;
+        cq_ptr = single_mmap ? sq_ptr
+            : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED)
+            return false;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe *) mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+
+        sq_head = at<unsigned>(sq_ptr, params.sq_off.head);
+        sq_tail = at<unsigned>(sq_ptr, params.sq_off.tail);
+        sq_mask = *at<unsigned>(sq_ptr, params.sq_off.ring_mask);
+        sq_entries = *at<unsigned>(sq_ptr, params.sq_off.ring_entries);
+        unsigned *sq_array = at<unsigned>(sq_ptr, params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; i++)
+            sq_array[i] = i;
+        sq_local_tail = *sq_tail;
+
+        cq_head = at<unsigned>(cq_ptr, params.cq_off.head);
+        cq_tail = at<unsigned>(cq_ptr, params.cq_off.tail);
+        cq_mask = *at<unsigned>(cq_ptr, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cq_ptr, params.cq_off.cqes);
+        return true;
+    }
+
+    bool supports(std::initializer_list<uint8_t> ops) {
+        size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+        std::vector<char> probe_data(probe_size, 0);
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_data.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+            return false;
+        for (uint8_t op : ops) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+
+    void enter(unsigned min_complete, unsigned flags) {
+        unsigned to_submit = sq_local_tail - *sq_tail;
+        std::atomic_ref(*sq_tail).store(sq_local_tail, std::memory_order_release);
+        for (;;) {
+            int ret = (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+            if (ret >= 0)
+                break;
+            if (errno == EBUSY || errno == EAGAIN) {
+                reap();
+            } else if (errno != EINTR) {
+                throw std::system_error(errno, std::system_category(), "io_uring_enter");
+            }
+            to_submit = 0;
+        }
+        reap();
+    }
+
+    void reap() {
+        unsigned head = *cq_head;
+        unsigned tail = std::atomic_ref(*cq_tail).load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            std::atomic_ref(*cq_head).store(head + 1, std::memory_order_release);
+            owed -= (unsigned) (cqe.user_data & 1);
+            UringOperation *op = reinterpret_cast<UringOperation *>(cqe.user_data & ~uint64_t(1));
+            if (op)
+                op->complete(cqe.res, cqe.flags);
+        }
+    }
+};
+
+// Ring of equally sized buffers the kernel picks from when receiving.
+class UringBufferGroup {
+public:
+    UringBufferGroup(Uring &ring, size_t buffer_size, uint16_t buffer_count)
+    : ring(ring), group_id(ring.allocate_group_id()), buffer_size(buffer_size), buffer_count(buffer_count),
+      storage(buffer_size * buffer_count) {
+        ring_size = buffer_count * sizeof(io_uring_buf);
+        buffers = (io_uring_buf_ring *) mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffers == MAP_FAILED)
+            throw std::system_error(errno, std::system_category(), "mmap");
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buffers);
+        reg.ring_entries = buffer_count;
+        reg.bgid = group_id;
+        if (syscall(__NR_io_uring_register, ring.get_fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            int error = errno;
+            munmap(buffers, ring_size);
+            throw std::system_error(error, std::system_category(), "IORING_REGISTER_PBUF_RING");
+        }
+
+        for (uint16_t id = 0; id < buffer_count; id++)
+            recycle(id);
+    }
+
+    ~UringBufferGroup() {
+        io_uring_buf_reg reg{};
+        reg.bgid = group_id;
+        syscall(__NR_io_uring_register, ring.get_fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(buffers, ring_size);
+    }
+
+    uint16_t get_group_id() { return group_id; }
+
+    size_t get_memory_usage() { return storage.size() + ring_size; }
+
+    char *get(uint16_t id) { return storage.data() + id * buffer_size; }
+
+    // Gives the buffer back to the kernel.
+    void recycle(uint16_t id) {
+        // Not buffers->bufs, in C++ the header's flexible array wrapper shifts it by 8 bytes.
+        io_uring_buf *buf = reinterpret_cast<io_uring_buf *>(buffers) + (tail & (buffer_count - 1));
+        buf->addr = reinterpret_cast<uint64_t>(get(id));
+        buf->len = (uint32_t) buffer_size;
+        buf->bid = id;
+        tail++;
+        std::atomic_ref(buffers->tail).store(tail, std::memory_order_release);
+    }
+
+private:
+    Uring &ring;
+    uint16_t group_id;
+    size_t buffer_size;
+    uint16_t buffer_count;
+    std::vector<char> storage;
+    io_uring_buf_ring *buffers;
+    size_t ring_size;
+    uint16_t tail = 0;
+};
+
+#endif // __URING_H__
@@ -5,9 +5,15 @@
 #include <iostream>
 #include <variant>
 #include <atomic>
-#include <shared_mutex>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
 
 #include "utils.hpp"
+#include "frame_mailbox.hpp"
+#include "move_coalescer.hpp"
 #include "messages/gui.hpp"
 #include "messages/server.hpp"
 #include "buffers/buffers.hpp"
@@ -17,29 +23,125 @@ using boost::asio::ip::tcp;
 
 class Client {
 public:
-    Client(std::string player_name, EndPoint server_endpoint, EndPoint gui_endpoint,
-           uint16_t port)
-    : player_name(player_name), io_context(), 
-      server_buffer(io_context, server_endpoint), gui_buffer(io_context, port, gui_endpoint) {        
+    /* With io_uring the GUI and server sockets are received from on rings of their own.
+     * Frames are sent on a third, and messages for the server, which are queued for a
+     * sender of their own, on a fourth. */
+    Client(std::string player_name, EndPoint server_endpoint, std::vector<EndPoint> gui_endpoints,
+           uint16_t port, bool io_uring = false, bool coalesce_inputs = false,
+           std::chrono::steady_clock::duration coalesce_deadline = {})
+    : player_name(player_name), io_context(),
+      gui_ring(io_uring ? Uring::create() : nullptr), server_ring(io_uring ? Uring::create() : nullptr),
+      frame_ring(io_uring ? Uring::create() : nullptr), send_ring(io_uring ? Uring::create() : nullptr),
+      server_buffer(io_context, server_endpoint, server_ring.get(), send_ring.get()),
+      gui_buffer(io_context, port, gui_endpoints, gui_ring.get(), frame_ring.get()),
+      coalesce_inputs(coalesce_inputs), coalescer(coalesce_deadline) {        
         connect_to_server();
     }
 
+    /* Frames are sent by a thread of their own, so that applying the next turn
+     * overlaps with sending the frame of the last one. Likewise for messages to the
+     * server, so that a slow server link never holds up GUI inputs. */
     void run() {
+        frame_sender = true;
+        frame_thread = std::thread([this](){ this->send_frames_to_gui(); });
         std::thread t1([this](){ this->listen_to_gui(); });
-        std::thread t2([this](){ this->listen_to_server(); });
+        std::thread t2([this](){
+            this->listen_to_server(server_buffer);
+            exit(1);
+        });
+        std::thread t4([this](){ this->send_to_server(); });
+        std::thread t5;
+        if (coalesce_inputs && coalescer.has_deadline())
+            t5 = std::thread([this](){ this->flush_held_moves(); });
         t1.join();
         t2.join();
+        t4.join();
+        if (t5.joinable())
+            t5.join();
+    }
+
+    // Runs both directions as coroutines on the client's io_context in this thread.
+    void run_coroutines() {
+        server_buffer.set_blocking(false);
+        gui_buffer.set_blocking(false);
+        auto rethrow = [](std::exception_ptr error) { if (error) std::rethrow_exception(error); };
+        boost::asio::co_spawn(io_context, listen_to_gui_async(), rethrow);
+        boost::asio::co_spawn(io_context, listen_to_server_async(), rethrow);
+        io_context.run();
+    }
+
+    /* Memory held by the client's buffers and transports, not counting the game
+     * state or the blocks the shared pool keeps for reuse. Not for a running client. */
+    size_t get_memory_usage() {
+        return sizeof(*this) + server_buffer.get_memory_usage() + gui_buffer.get_memory_usage();
+    }
+
+    /* Handles messages from the server until it goes away. Messages already received
+     * are handled before drawing, so that a backlog of turns is caught up with instead
+     * of being drawn turn by turn. Any buffer with try_receive() and a throwing >>
+     * will do, such as one replaying recorded messages. */
+    template <typename Buffer>
+    void listen_to_server(Buffer &buff) {
+        for (;;) {
+            ServerMessageView message;
+            try {
+                DecodeError error = buff.try_receive(message);
+                if (error == DecodeError::Incomplete) {
+                    flush_pending_frame();
+                    buff >> message;
+                } else if (error != DecodeError::None) {
+                    break;
+                }
+            } catch (...) { break; }
+            respond_to_server(message);
+        }
+        stop_drawing();
     }
 
 private:
     std::string player_name;
     boost::asio::io_context io_context;
+    std::unique_ptr<Uring> gui_ring;
+    std::unique_ptr<Uring> server_ring;
+    std::unique_ptr<Uring> frame_ring;
+    std::unique_ptr<Uring> send_ring;
     TCPBuffer server_buffer;
     UDPBuffer gui_buffer;
 
-    mutable std::shared_mutex game_state_mutex;
+    /* With a sender thread, frames are encoded into a copy handed over through the
+     * mailbox, as the game state changes while they are being sent. */
+    bool frame_sender = false;
+    std::thread frame_thread;
+    MemoryOutBuffer frame_encoder;
+    FrameMailbox frames;
+    size_t replaced_frames = 0;
+
+    // With coalescing, moves are held for the server, see MoveCoalescer.
+    bool coalesce_inputs;
+    std::mutex server_send_mutex;
+    std::condition_variable move_held;
+    MoveCoalescer<ClientMessage> coalescer;
+
+    // Set while the server's send queue is full, so that it is only reported once it fills up.
+    bool server_congested = false;
+
+    /* Only the thread listening to the server touches the game state. What the GUI
+     * thread needs to know about it is published in atomics, so that forwarding an
+     * input never waits for a turn being applied. */
     DrawMessage game_state;
-    bool observer = true;
+    std::atomic<bool> in_lobby = true;
+    std::atomic<bool> observer = true;
+    size_t oversized_frames = 0;
+    size_t largest_oversized_frame = 0;
+
+    /* The frame of the newest turn is only sent once no further message is waiting.
+     * When turns pile up, they are all applied and only the last one is drawn. */
+    bool frame_pending = false;
+    size_t skipped_frames = 0;
+    size_t catch_ups = 0;
+    size_t catch_up_skipped = 0;
+    std::chrono::steady_clock::time_point catch_up_start;
+    std::chrono::steady_clock::duration catch_up_time{};
 
     void connect_to_server() {
         ServerMessage message;
@@ -52,84 +154,319 @@ private:
     }
 
     bool is_in_lobby() {
-        std::shared_lock lock(game_state_mutex);
-        return std::holds_alternative<Lobby>(game_state);
+        return in_lobby.load(std::memory_order_acquire);
+    }
+
+    // Only changes in the lobby, before the phase that makes it matter is published.
+    bool is_observer() {
+        return observer.load(std::memory_order_relaxed);
     }
 
+    /* Frames too big for a datagram are skipped, a later one may fit again.
+     * They are counted and reported with the totals at the end of the game. */
     void send_state_to_gui() {
-        gui_buffer << game_state;
-        gui_buffer.send();
+        size_t frame_size = encoded_size(game_state);
+        if (frame_size > UDPBuffer::MAX_DATAGRAM_SIZE) {
+            oversized_frames++;
+            largest_oversized_frame = std::max(largest_oversized_frame, frame_size);
+            return;
+        }
+
+        if (!frame_sender) {
+            gui_buffer.reserve(frame_size);
+            gui_buffer << game_state;
+            gui_buffer.send();
+            // Nothing waits on the ring of the sending thread, so its sends are submitted right away.
+            if (frame_ring)
+                frame_ring->submit();
+            return;
+        }
+
+        frame_encoder.reserve(frame_size);
+        frame_encoder << game_state;
+        frame_encoder.take(frames.back());
+        // Counted only, a slow GUI is when this happens and writing to stderr may block.
+        replaced_frames += !frames.publish();
     }
 
-    void respond_to_server_in_lobby(ServerMessage &message) {
+    void report_oversized_frames() {
+        if (oversized_frames == 0)
+            return;
+        std::cerr << oversized_frames << " frames did not fit in a UDP datagram and were not sent to the GUI, "
+                  << "the largest was " << largest_oversized_frame << " bytes.\n";
+        oversized_frames = 0;
+        largest_oversized_frame = 0;
+    }
+
+    void report_replaced_frames() {
+        if (replaced_frames == 0)
+            return;
+        std::cerr << replaced_frames << " frames replaced by newer ones before they were sent to the GUI.\n";
+        replaced_frames = 0;
+    }
+
+    void send_frames_to_gui() {
+        std::string frame;
+        while (frames.take(frame)) {
+            try {
+                gui_buffer.send(frame);
+                // A newer frame already waiting goes to the kernel in the same submit.
+                if (frame_ring && !frames.has_newer())
+                    frame_ring->submit();
+            } catch (...) {}
+        }
+    }
+
+    void respond_to_server_in_lobby(ServerMessageView &message) {
         std::visit(visitors {
             [this](AcceptedPlayer &accepted_player) {
-                std::unique_lock lock(game_state_mutex);
                 if (accepted_player.get_player().get_name() == player_name)
-                    observer = false;
+                    observer.store(false, std::memory_order_relaxed);
                 std::get<Lobby>(game_state).add_player(std::move(accepted_player));
                 send_state_to_gui();
             },
             [this](GameStarted &game_started) {
-                std::unique_lock lock(game_state_mutex);
                 game_state = std::get<Lobby>(game_state).start_game(std::move(game_started));
+                in_lobby.store(false, std::memory_order_release);
             },
             [](auto){ throw std::runtime_error("Unexpected server message in lobby."); }
         }, message);
     }
 
-    void respond_to_server_during_game(ServerMessage &message) {
+    // The frame of the turn before was not sent, a newer one arrived in the meantime.
+    void skip_pending_frame() {
+        if (catch_up_skipped == 0)
+            catch_up_start = std::chrono::steady_clock::now();
+        catch_up_skipped++;
+        skipped_frames++;
+        frame_pending = false;
+        std::get<Game>(game_state).next_turn();
+    }
+
+    // Called when no further message is waiting.
+    void flush_pending_frame() {
+        if (!frame_pending)
+            return;
+        frame_pending = false;
+        send_state_to_gui();
+        std::get<Game>(game_state).next_turn();
+        end_catch_up();
+    }
+
+    // Counts a catch-up once the newest state has been drawn, they are reported when the game ends.
+    void end_catch_up() {
+        if (catch_up_skipped == 0)
+            return;
+        catch_up_time += std::chrono::steady_clock::now() - catch_up_start;
+        catch_ups++;
+        catch_up_skipped = 0;
+    }
+
+    // Not while turns are applied, writing to stderr may block.
+    void report_catch_ups() {
+        if (catch_ups == 0)
+            return;
+        std::cerr << "Caught up " << catch_ups << " times, skipping " << skipped_frames << " frames in "
+                  << std::chrono::duration_cast<std::chrono::microseconds>(catch_up_time).count() << " us.\n";
+        catch_ups = 0;
+        skipped_frames = 0;
+        catch_up_time = {};
+    }
+
+    // Called with server_send_mutex held.
+    void hold_move(ClientMessage move) {
+        if (coalescer.hold(move))
+            move_held.notify_one();
+    }
+
+    void send_held_move() {
+        std::lock_guard lock(server_send_mutex);
+        if (std::optional<ClientMessage> move = coalescer.take()) {
+            server_buffer << *move;
+            queue_for_server();
+        }
+    }
+
+    // Sends a move once it has been held for the deadline, unless a turn sent it first.
+    void flush_held_moves() {
+        std::unique_lock lock(server_send_mutex);
+        for (;;) {
+            if (!coalescer.is_holding()) {
+                move_held.wait(lock);
+            } else if (std::optional<ClientMessage> move = coalescer.take_due()) {
+                server_buffer << *move;
+                queue_for_server();
+            } else {
+                move_held.wait_until(lock, coalescer.get_deadline());
+            }
+        }
+    }
+
+    void report_coalescing() {
+        std::lock_guard lock(server_send_mutex);
+        coalescer.drop();
+        std::cerr << "Coalesced inputs: " << coalescer.get_sent() << " moves sent to the server, "
+                  << coalescer.get_dropped() << " dropped for newer ones so far.\n";
+    }
+
+    // Turns are applied straight from the receive buffer.
+    void respond_to_server_during_game(ServerMessageView &message) {
         std::visit(visitors {
-            [this](Turn &turn) {
-                std::unique_lock lock(game_state_mutex);
-                Game &game = std::get<Game>(game_state);
-                game.process_turn(std::move(turn));
-                send_state_to_gui();
-                game.next_turn();
+            [this](TurnView &turn) {
+                if (coalesce_inputs)
+                    send_held_move();
+                if (frame_pending)
+                    skip_pending_frame();
+                std::get<Game>(game_state).process_turn(turn);
+                frame_pending = true;
             }, 
             [this]([[maybe_unused]] GameEnded &game_ended) {
-                std::unique_lock lock(game_state_mutex);
+                if (frame_pending)
+                    skip_pending_frame();
                 game_state = std::get<Game>(game_state).end_game();
+                in_lobby.store(true, std::memory_order_release);
                 send_state_to_gui();
+                end_catch_up();
+                report_catch_ups();
+                report_replaced_frames();
+                report_oversized_frames();
+                if (coalesce_inputs)
+                    report_coalescing();
+                // A lobby only needs small buffers, the big ones go back to the pool.
+                server_buffer.trim_receiving();
+                if (frame_sender)
+                    frame_encoder.trim();
+                else
+                    gui_buffer.trim_sending();
             },
             [](auto){ throw std::runtime_error("Unexpected server message during a game."); }
         }, message);
     }
 
-    void listen_to_server() {
+    void respond_to_server(ServerMessageView &message) {
+        if (std::holds_alternative<Lobby>(game_state)) {
+            respond_to_server_in_lobby(message);
+        } else {
+            respond_to_server_during_game(message);
+        }
+    }
+
+    /* The server is gone. The newest state is still drawn, and the frame sender is
+     * shut down once it has sent what was published. */
+    void stop_drawing() {
+        flush_pending_frame();
+        if (frame_sender) {
+            frames.close();
+            frame_thread.join();
+        }
+    }
+
+    [[noreturn]] void disconnect() {
+        stop_drawing();
+        exit(1);
+    }
+
+    boost::asio::awaitable<void> listen_to_server_async() {
         for (;;) {
-            ServerMessage message;
-            try { server_buffer >> message; } 
-            catch (...) { exit(1); }
-            if (is_in_lobby()) {
-                respond_to_server_in_lobby(message);
-            } else {
-                respond_to_server_during_game(message);
-            }
+            ServerMessageView message;
+            try {
+                DecodeError error = server_buffer.try_receive(message);
+                if (error == DecodeError::Incomplete) {
+                    flush_pending_frame();
+                    error = co_await server_buffer.async_receive(message);
+                }
+                if (error != DecodeError::None) {
+                    disconnect();
+                }
+            } catch (...) { disconnect(); }
+            respond_to_server(message);
+        }
+    }
+
+    // Called by one thread at a time, as writing messages to the server is. Joins are never dropped.
+    void queue_for_server(bool join = false) {
+        if (server_buffer.queue_send(!join)) {
+            server_congested = false;
+        } else if (!server_congested) {
+            server_congested = true;
+            std::cerr << "The server is not keeping up, dropping messages (" << server_buffer.get_dropped_sends()
+                      << " sends dropped so far).\n";
         }
     }
 
-    void join_game() {
-        server_buffer << ClientMessage(Join(player_name));
-        server_buffer.send();
+    // A failed write ends the client, as a failed read does.
+    void send_to_server() {
+        try {
+            server_buffer.write_send_queue();
+        } catch (std::exception &error) {
+            std::cerr << error.what() << "\n";
+            exit(1);
+        }
+    }
+
+    // Started whenever messages are queued while no writer runs, returns once they are written.
+    boost::asio::awaitable<void> send_to_server_async() {
+        try {
+            co_await server_buffer.async_write_send_queue();
+        } catch (std::exception &error) {
+            std::cerr << error.what() << "\n";
+            exit(1);
+        }
     }
 
-    void send_move_to_server(InputMessage &input_message) {
+    static ClientMessage move_message(InputMessage &input_message) {
         ClientMessage client_message;
         std::visit([&client_message](auto move){ client_message = move; }, input_message);
-        server_buffer << client_message;
-        server_buffer.send();
+        return client_message;
     }
 
+    // Inputs that arrived together are queued for the server at once.
     void listen_to_gui() {
+        std::vector<InputMessage> input_messages;
+        for (;;) {
+            try {
+                gui_buffer.receive_batch(input_messages);
+                std::unique_lock lock(server_send_mutex, std::defer_lock);
+                if (coalesce_inputs)
+                    lock.lock();
+                bool queued = false;
+                bool join = false;
+                for (InputMessage &input_message : input_messages) {
+                    if (is_in_lobby()) {
+                        server_buffer << ClientMessage(Join(player_name));
+                        queued = join = true;
+                    } else if (!is_observer() && coalesce_inputs) {
+                        hold_move(move_message(input_message));
+                    } else if (!is_observer()) {
+                        server_buffer << move_message(input_message);
+                        queued = true;
+                    }
+                }
+                if (queued) {
+                    queue_for_server(join);
+                }
+            } catch (...) {}
+        }
+    }
+
+    boost::asio::awaitable<void> listen_to_gui_async() {
         InputMessage input_message;
         for (;;) {
             try {
-                gui_buffer >> input_message;
-                if (is_in_lobby()) {
-                    join_game();
-                } else if (!observer) {
-                    send_move_to_server(input_message);
+                if (co_await gui_buffer.async_receive(input_message) != DecodeError::None) {
+                    continue;
+                }
+                bool join = is_in_lobby();
+                if (join) {
+                    server_buffer << ClientMessage(Join(player_name));
+                } else if (!is_observer()) {
+                    server_buffer << move_message(input_message);
+                } else {
+                    continue;
+                }
+                queue_for_server(join);
+                if (server_buffer.claim_send_writer()) {
+                    boost::asio::co_spawn(io_context, send_to_server_async(), boost::asio::detached);
                 }
             } catch (...) {}
         }
@@ -0,0 +1,67 @@
+#ifndef __FRAME_MAILBOX_H__
+#define __FRAME_MAILBOX_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/* Hands encoded frames from the thread applying turns to the one sending them.
+ * Only the newest frame is kept, one not taken before the next is published is
+ * dropped, so a slow send never holds up the game and the GUI gets the newest state.
+ * Three strings are swapped around, so frames are not allocated once they stop growing. */
+class FrameMailbox {
+public:
+    // Where the publishing thread encodes its next frame.
+    std::string &back() { return writing; }
+
+    // Makes back() the newest frame. Returns false if it replaced one that was not taken.
+    bool publish() {
+        bool replaced;
+        {
+            std::lock_guard lock(mutex);
+            std::swap(writing, ready);
+            replaced = fresh;
+            fresh = true;
+        }
+        available.notify_one();
+        return !replaced;
+    }
+
+    /* Waits for a frame newer than the one taken last and swaps it into frame.
+     * Returns false once the mailbox is closed. */
+    bool take(std::string &frame) {
+        std::unique_lock lock(mutex);
+        available.wait(lock, [this]() { return fresh || closed; });
+        if (!fresh)
+            return false;
+        std::swap(frame, ready);
+        fresh = false;
+        return true;
+    }
+
+    // Whether take() has a newer frame without waiting.
+    bool has_newer() {
+        std::lock_guard lock(mutex);
+        return fresh;
+    }
+
+    // Wakes up the taking thread for good, frames published before are still taken.
+    void close() {
+        {
+            std::lock_guard lock(mutex);
+            closed = true;
+        }
+        available.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::string writing;
+    std::string ready;
+    bool fresh = false;
+    bool closed = false;
+};
+
+#endif // __FRAME_MAILBOX_H__
@@ -0,0 +1,340 @@
+#ifndef __ID_TABLE_H__
+#define __ID_TABLE_H__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "utils.hpp"
+
+/* Map from a one-byte id to V kept in a fixed array with a slot for every id and
+ * a bitmask of the occupied ones. It has no heap node per entry and iterates in
+ * id order, like the std::map it stands in for. Only occupied slots hold a value,
+ * so an empty table costs nothing to make, but it is 256 slots big. Meant for
+ * small values, see SparseIdTable for the others. */
+template <typename K, typename V>
+class IdTable {
+    static_assert(std::is_unsigned_v<K> && sizeof(K) == 1);
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+
+    static const size_t CAPACITY = 256;
+
+    template <bool CONST>
+    class basic_iterator {
+    public:
+        using table_type = std::conditional_t<CONST, const IdTable, IdTable>;
+        using value_type = IdTable::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<CONST, const value_type &, value_type &>;
+        using pointer = std::conditional_t<CONST, const value_type *, value_type *>;
+        using iterator_category = std::forward_iterator_tag;
+
+        basic_iterator() = default;
+
+        basic_iterator(table_type *table, size_t id) : table(table), id(id) {}
+
+        operator basic_iterator<true>() const { return basic_iterator<true>(table, id); }
+
+        reference operator*() const { return table->slots[id].key_val; }
+
+        pointer operator->() const { return &table->slots[id].key_val; }
+
+        basic_iterator &operator++() {
+            id = table->next_occupied(id + 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const basic_iterator &other) const { return id == other.id; }
+
+    private:
+        table_type *table = nullptr;
+        size_t id = CAPACITY;
+
+        friend IdTable;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    IdTable() = default;
+
+    IdTable(std::initializer_list<std::pair<K, V>> entries) {
+        for (const std::pair<K, V> &entry : entries)
+            (*this)[entry.first] = entry.second;
+    }
+
+    IdTable(const IdTable &other) {
+        copy_from(other);
+    }
+
+    IdTable(IdTable &&other) {
+        move_from(other);
+    }
+
+    IdTable &operator=(const IdTable &other) {
+        if (this != &other) {
+            clear();
+            copy_from(other);
+        }
+        return *this;
+    }
+
+    IdTable &operator=(IdTable &&other) {
+        if (this != &other) {
+            clear();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    ~IdTable() {
+        clear();
+    }
+
+    V &operator[](K key) {
+        if (!contains(key)) {
+            new (&slots[key].key_val) value_type(key, V());
+            occupied[key / 64] |= uint64_t(1) << (key % 64);
+        }
+        return slots[key].key_val.second;
+    }
+
+    bool contains(K key) const { return occupied[key / 64] >> (key % 64) & 1; }
+
+    iterator find(K key) { return contains(key) ? iterator(this, key) : end(); }
+
+    const_iterator find(K key) const { return contains(key) ? const_iterator(this, key) : end(); }
+
+    void erase(K key) {
+        if (contains(key)) {
+            occupied[key / 64] &= ~(uint64_t(1) << (key % 64));
+            slots[key].key_val.~value_type();
+        }
+    }
+
+    void erase(const_iterator it) { erase((K) it.id); }
+
+    void clear() {
+        for (value_type &key_val : *this)
+            key_val.~value_type();
+        occupied = {};
+    }
+
+    size_t size() const {
+        size_t count = 0;
+        for (uint64_t bits : occupied)
+            count += (size_t) __builtin_popcountll(bits);
+        return count;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    iterator begin() { return iterator(this, next_occupied(0)); }
+
+    iterator end() { return iterator(this, CAPACITY); }
+
+    const_iterator begin() const { return const_iterator(this, next_occupied(0)); }
+
+    const_iterator end() const { return const_iterator(this, CAPACITY); }
+
+private:
+    // Holds a value only while its bit in occupied is set.
+    union Slot {
+        Slot() {}
+        ~Slot() {}
+
+        value_type key_val;
+    };
+
+    std::array<Slot, CAPACITY> slots;
+    std::array<uint64_t, CAPACITY / 64> occupied{};
+
+    void copy_from(const IdTable &other) {
+        for (const value_type &key_val : other)
+            new (&slots[key_val.first].key_val) value_type(key_val);
+        occupied = other.occupied;
+    }
+
+    void move_from(IdTable &other) {
+        for (value_type &key_val : other)
+            new (&slots[key_val.first].key_val) value_type(key_val.first, std::move(key_val.second));
+        occupied = other.occupied;
+    }
+
+    // First occupied id at or after id, or CAPACITY if there is none.
+    size_t next_occupied(size_t id) const {
+        size_t word = id / 64;
+        if (word == occupied.size())
+            return CAPACITY;
+        uint64_t bits = occupied[word] & (~uint64_t(0) << (id % 64));
+        while (bits == 0) {
+            if (++word == occupied.size())
+                return CAPACITY;
+            bits = occupied[word];
+        }
+        return word * 64 + (size_t) __builtin_ctzll(bits);
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const IdTable &table) {
+        stream << "{ ";
+        for (const value_type &key_val : table) {
+            stream << key_val << ", ";
+        }
+        stream << " }";
+        return stream;
+    }
+};
+
+/* The same map for values too big to have a slot for every id: a vector of the
+ * occupied entries in id order and the bitmask of their ids. The position of an
+ * entry is the number of occupied ids below its own. Inserting out of id order or
+ * erasing anything but the last entry moves the entries, which ids rarely need.
+ * Unlike in IdTable, an insert invalidates references to the other values. */
+template <typename K, typename V>
+class SparseIdTable {
+    static_assert(std::is_unsigned_v<K> && sizeof(K) == 1);
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    SparseIdTable() = default;
+
+    SparseIdTable(std::initializer_list<std::pair<K, V>> entries) {
+        for (const std::pair<K, V> &entry : entries)
+            (*this)[entry.first] = entry.second;
+    }
+
+    SparseIdTable(const SparseIdTable &other) = default;
+
+    SparseIdTable(SparseIdTable &&other) = default;
+
+    // The keys are const, so the entries are copied into a new vector rather than assigned.
+    SparseIdTable &operator=(const SparseIdTable &other) {
+        if (this != &other) {
+            entries = std::vector<value_type>(other.entries);
+            occupied = other.occupied;
+        }
+        return *this;
+    }
+
+    SparseIdTable &operator=(SparseIdTable &&other) = default;
+
+    V &operator[](K key) {
+        size_t pos = position(key);
+        if (!contains(key)) {
+            if (pos == entries.size()) {
+                entries.emplace_back(key, V());
+            } else {
+                insert_at(pos, key);
+            }
+            occupied[key / 64] |= uint64_t(1) << (key % 64);
+        }
+        return entries[pos].second;
+    }
+
+    bool contains(K key) const { return occupied[key / 64] >> (key % 64) & 1; }
+
+    iterator find(K key) { return contains(key) ? entries.begin() + (ptrdiff_t) position(key) : end(); }
+
+    const_iterator find(K key) const { return contains(key) ? entries.begin() + (ptrdiff_t) position(key) : end(); }
+
+    void erase(K key) {
+        if (contains(key)) {
+            erase_at(position(key));
+            occupied[key / 64] &= ~(uint64_t(1) << (key % 64));
+        }
+    }
+
+    void erase(const_iterator it) { erase(it->first); }
+
+    void clear() {
+        entries.clear();
+        occupied = {};
+    }
+
+    size_t size() const { return entries.size(); }
+
+    bool empty() const { return entries.empty(); }
+
+    iterator begin() { return entries.begin(); }
+
+    iterator end() { return entries.end(); }
+
+    const_iterator begin() const { return entries.begin(); }
+
+    const_iterator end() const { return entries.end(); }
+
+private:
+    std::vector<value_type> entries;
+    std::array<uint64_t, 4> occupied{};
+
+    // Number of occupied ids below key.
+    size_t position(K key) const {
+        size_t pos = 0;
+        for (size_t word = 0; word < key / 64u; word++)
+            pos += (size_t) __builtin_popcountll(occupied[word]);
+        uint64_t below = occupied[key / 64] & ((uint64_t(1) << (key % 64)) - 1);
+        return pos + (size_t) __builtin_popcountll(below);
+    }
+
+    void insert_at(size_t pos, K key) {
+        std::vector<value_type> moved;
+        moved.reserve(entries.size() + 1);
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i == pos)
+                moved.emplace_back(key, V());
+            moved.emplace_back(entries[i].first, std::move(entries[i].second));
+        }
+        entries = std::move(moved);
+    }
+
+    void erase_at(size_t pos) {
+        if (pos + 1 == entries.size()) {
+            entries.pop_back();
+            return;
+        }
+        std::vector<value_type> moved;
+        moved.reserve(entries.size() - 1);
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i != pos)
+                moved.emplace_back(entries[i].first, std::move(entries[i].second));
+        }
+        entries = std::move(moved);
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const SparseIdTable &table) {
+        stream << "{ ";
+        for (const value_type &key_val : table) {
+            stream << key_val << ", ";
+        }
+        stream << " }";
+        return stream;
+    }
+};
+
+// Either layout, for code that only needs what they have in common.
+template <typename T>
+concept id_table = std::is_same_v<T, IdTable<typename T::key_type, typename T::mapped_type>>
+                || std::is_same_v<T, SparseIdTable<typename T::key_type, typename T::mapped_type>>;
+
+#endif // __ID_TABLE_H__
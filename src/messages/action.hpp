@@ -79,16 +79,18 @@ public:
 
     Move(Direction direction) : direction(direction) {}
 
+    static constexpr auto wire_fields() { return std::tuple{&Move::direction}; }
+
 private:
     Direction direction;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Move &move) {
-        buff << move.direction;
+        buff.write_fixed(move);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, Move &move) {
-        buff >> move.direction;
+        buff.read_fixed(move);
         return buff;
     }
 
@@ -0,0 +1,220 @@
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "event.hpp"
+#include "../buffers/outbuffers.hpp"
+
+/* Set of cells of a size_x × size_y board, one bit per cell. Cells are stored
+ * column by column, so iterating goes in Position order and the board encodes
+ * exactly like a std::set<Position> would. Cells outside the board are ignored. */
+class Board {
+public:
+    using value_type = Position;
+
+    class iterator {
+    public:
+        using value_type = Position;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Position;
+        using iterator_category = std::forward_iterator_tag;
+
+        iterator() = default;
+
+        iterator(const Board *board, size_t word)
+        : board(board), word(board->next_word(word)), column_end(board->size_y) {
+            if (this->word < board->words.size())
+                bits = board->words[this->word];
+        }
+
+        // Cells only move forward, so the column is found without dividing.
+        Position operator*() const {
+            size_t cell = word * 64 + (size_t) __builtin_ctzll(bits);
+            while (cell >= column_end) {
+                x++;
+                column_end += board->size_y;
+            }
+            return Position(x, (Position::coord_t) (cell + board->size_y - column_end));
+        }
+
+        iterator &operator++() {
+            bits &= bits - 1;
+            if (bits == 0) {
+                word = board->next_word(word + 1);
+                if (word < board->words.size())
+                    bits = board->words[word];
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const iterator &other) const { return word == other.word && bits == other.bits; }
+
+    private:
+        const Board *board = nullptr;
+        size_t word = 0;
+        uint64_t bits = 0;
+        mutable Position::coord_t x = 0;
+        mutable size_t column_end = 0;
+    };
+
+    using const_iterator = iterator;
+
+    Board() = default;
+
+    Board(Position::coord_t size_x, Position::coord_t size_y)
+    : size_x(size_x), size_y(size_y), words(((size_t) size_x * size_y + 63) / 64),
+      summary((words.size() + 63) / 64) {}
+
+    bool contains(const Position &position) const {
+        if (!on_board(position))
+            return false;
+        size_t cell = cell_index(position);
+        return words[cell / 64] >> (cell % 64) & 1;
+    }
+
+    void insert(const Position &position) {
+        if (!on_board(position))
+            return;
+        size_t cell = cell_index(position);
+        uint64_t bit = uint64_t(1) << (cell % 64);
+        count += !(words[cell / 64] & bit);
+        words[cell / 64] |= bit;
+        summary[cell / 64 / 64] |= uint64_t(1) << (cell / 64 % 64);
+    }
+
+    void erase(const Position &position) {
+        if (!on_board(position))
+            return;
+        size_t cell = cell_index(position);
+        uint64_t bit = uint64_t(1) << (cell % 64);
+        count -= !!(words[cell / 64] & bit);
+        words[cell / 64] &= ~bit;
+        if (words[cell / 64] == 0)
+            summary[cell / 64 / 64] &= ~(uint64_t(1) << (cell / 64 % 64));
+    }
+
+    void clear() {
+        if (count > 0) {
+            std::fill(words.begin(), words.end(), 0);
+            std::fill(summary.begin(), summary.end(), 0);
+        }
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    // First y in [from, to) with (x, y) on the board, or to if there is none.
+    size_t next_in_column(Position::coord_t x, size_t from, size_t to) const {
+        size_t base = (size_t) x * size_y;
+        return find_next(base + from, base + to) - base;
+    }
+
+    // Last y in [from, to) with (x, y) on the board, or to if there is none.
+    size_t last_in_column(Position::coord_t x, size_t from, size_t to) const {
+        size_t base = (size_t) x * size_y;
+        return find_last(base + from, base + to) - base;
+    }
+
+    // Inserts (x, y) for every y in [from, to), a word at a time.
+    void insert_in_column(Position::coord_t x, size_t from, size_t to) {
+        size_t cell = (size_t) x * size_y + from;
+        size_t end = (size_t) x * size_y + to;
+        while (cell < end) {
+            size_t n = std::min(end - cell, 64 - cell % 64);
+            uint64_t bits = (n == 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1) << (cell % 64);
+            count += (size_t) __builtin_popcountll(bits & ~words[cell / 64]);
+            words[cell / 64] |= bits;
+            summary[cell / 64 / 64] |= uint64_t(1) << (cell / 64 % 64);
+            cell += n;
+        }
+    }
+
+    iterator begin() const { return count > 0 ? iterator(this, 0) : end(); }
+
+    iterator end() const { return iterator(this, words.size()); }
+
+private:
+    Position::coord_t size_x = 0;
+    Position::coord_t size_y = 0;
+    std::vector<uint64_t> words;
+    // Bit w is set when words[w] is not empty, so that iterating skips empty stretches fast.
+    std::vector<uint64_t> summary;
+    size_t count = 0;
+
+    // First non-empty word at or after word, or words.size() if there is none.
+    size_t next_word(size_t word) const {
+        size_t i = word / 64;
+        if (i >= summary.size())
+            return words.size();
+        uint64_t bits = summary[i] & (~uint64_t(0) << (word % 64));
+        while (bits == 0) {
+            if (++i == summary.size())
+                return words.size();
+            bits = summary[i];
+        }
+        return i * 64 + (size_t) __builtin_ctzll(bits);
+    }
+
+    size_t find_next(size_t from, size_t to) const {
+        while (from < to) {
+            uint64_t bits = words[from / 64] >> (from % 64);
+            if (bits != 0)
+                return std::min(from + (size_t) __builtin_ctzll(bits), to);
+            from = (from / 64 + 1) * 64;
+        }
+        return to;
+    }
+
+    size_t find_last(size_t from, size_t to) const {
+        size_t end = to;
+        while (end > from) {
+            size_t last = end - 1;
+            uint64_t bits = words[last / 64] << (63 - last % 64);
+            if (bits != 0) {
+                size_t found = last - (size_t) __builtin_clzll(bits);
+                return found >= from ? found : to;
+            }
+            end = last / 64 * 64;
+        }
+        return to;
+    }
+
+    bool on_board(const Position &position) const {
+        return position.get_x() < size_x && position.get_y() < size_y;
+    }
+
+    size_t cell_index(const Position &position) const {
+        return (size_t) position.get_x() * size_y + position.get_y();
+    }
+
+    friend OutBuffer &operator<<(OutBuffer &buff, const Board &board) {
+        buff << static_cast<uint32_t>(board.size());
+        buff.write_fixed_elements(board);
+        return buff;
+    }
+
+    friend size_t encoded_size(const Board &board) {
+        return encoded_elements_size(board);
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const Board &board) {
+        stream << "Board { ";
+        for (Position position : board)
+            stream << position << " ";
+        stream << "}";
+        return stream;
+    }
+};
+
+#endif // __BOARD_H__
@@ -2,11 +2,13 @@
 #define __EVENT_H__
 
 #include <string>
-#include <list>
+#include <boost/container/small_vector.hpp>
+#include <type_traits>
 #include <variant>
 
 #include "../buffers/outbuffers.hpp"
 #include "../buffers/inbuffers.hpp"
+#include "../id_table.hpp"
 #include "../utils.hpp"
 
 using score_t = uint32_t;
@@ -30,10 +32,14 @@ private:
     std::string address;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Player &player) {
-        buff << player.name << player.address;
+        buff << StringRef{player.name} << StringRef{player.address};
         return buff;
     }
     
+    friend size_t encoded_size(const Player &player) {
+        return encoded_size(player.name) + encoded_size(player.address);
+    }
+
     friend InBuffer &operator>>(InBuffer &buff, Player &player) {
         buff >> player.name >> player.address;
         return buff;
@@ -45,6 +51,13 @@ private:
     }
 };
 
+/* Per-player data, at most one entry for each of the 256 ids. Small plain values,
+ * such as positions and scores, get a slot for every id, the rest only take room
+ * for the players there are. */
+template <typename V>
+using PlayerTable = std::conditional_t<std::is_trivially_copyable_v<V> && sizeof(V) <= 8,
+                                       IdTable<Player::id_t, V>, SparseIdTable<Player::id_t, V>>;
+
 class Position {
 public:
     using coord_t = uint16_t;
@@ -76,17 +89,20 @@ public:
         }
     }
 
+    // Fields in wire order, see buffers/schema.hpp.
+    static constexpr auto wire_fields() { return std::tuple{&Position::x, &Position::y}; }
+
 private:
     coord_t x;
     coord_t y;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Position &position) {
-        buff << position.x << position.y;
+        buff.write_fixed(position);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, Position &position) {
-        buff >> position.x >> position.y;
+        buff.read_fixed(position);
         return buff;
     }
 
@@ -106,27 +122,23 @@ public:
 
     Bomb(Position position, timer_t timer) : position(position), timer(timer) {}
 
-    void decrease_timer() {
-        if (timer == 0)
-            throw std::runtime_error("Decreasing zero timer.");
-        timer--;
-    }
-
     Position get_position() const {
         return position;
     }
 
+    static constexpr auto wire_fields() { return std::tuple{&Bomb::position, &Bomb::timer}; }
+
 private:
     Position position;
     timer_t timer;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Bomb &bomb) {
-        buff << bomb.position << bomb.timer;
+        buff.write_fixed(bomb);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, Bomb &bomb) {
-        buff >> bomb.position >> bomb.timer;
+        buff.read_fixed(bomb);
         return buff;
     }
 
@@ -146,17 +158,19 @@ public:
 
     Position get_position() const { return position; }
 
+    static constexpr auto wire_fields() { return std::tuple{&BombPlaced::id, &BombPlaced::position}; }
+
 private:
     Bomb::id_t id;
     Position position;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const BombPlaced &bomb_placed) {
-        buff << bomb_placed.id << bomb_placed.position;
+        buff.write_fixed(bomb_placed);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, BombPlaced &bomb_placed) {
-        buff >> bomb_placed.id >> bomb_placed.position;
+        buff.read_fixed(bomb_placed);
         return buff;
     }
 
@@ -168,22 +182,25 @@ private:
 
 class BombExploded {
 public:
+    // An explosion rarely destroys more than a block per direction, so these are kept inline.
+    using robots_t = boost::container::small_vector<Player::id_t, 4>;
+    using blocks_t = boost::container::small_vector<Position, 4>;
+
     BombExploded() = default;
 
-    BombExploded(Bomb::id_t id, std::list<Player::id_t> robots_destroyed,
-                 std::list<Position> blocks_destroyed)
-    : id(id), robots_destroyed(robots_destroyed), blocks_destroyed(blocks_destroyed) {}
+    BombExploded(Bomb::id_t id, robots_t robots_destroyed, blocks_t blocks_destroyed)
+    : id(id), robots_destroyed(std::move(robots_destroyed)), blocks_destroyed(std::move(blocks_destroyed)) {}
 
     Bomb::id_t get_id() const { return id; }
 
-    const std::list<Player::id_t> &get_robots_destroyed() const { return robots_destroyed; }
+    const robots_t &get_robots_destroyed() const { return robots_destroyed; }
 
-    const std::list<Position> &get_blocks_destroyed() const { return blocks_destroyed; }
+    const blocks_t &get_blocks_destroyed() const { return blocks_destroyed; }
 
 private:
     Bomb::id_t id;
-    std::list<Player::id_t> robots_destroyed;
-    std::list<Position> blocks_destroyed;
+    robots_t robots_destroyed;
+    blocks_t blocks_destroyed;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const BombExploded &bomb_exploded) {
         buff << bomb_exploded.id << bomb_exploded.robots_destroyed << bomb_exploded.blocks_destroyed;
@@ -203,6 +220,42 @@ private:
     }
 };
 
+// BombExploded read in place from the bytes of a received message, see TurnView.
+class BombExplodedView {
+public:
+    BombExplodedView() = default;
+
+    Bomb::id_t get_id() const { return id; }
+
+    WireListView<Player::id_t> get_robots_destroyed() const { return robots_destroyed; }
+
+    WireListView<Position> get_blocks_destroyed() const { return blocks_destroyed; }
+
+    // Moves past a BombExploded, checking that all of it has been received.
+    static void skip(InBuffer &buff) {
+        uint32_t list_size;
+        buff.skip(wire_size<Bomb::id_t>());
+        buff >> list_size;
+        buff.skip((size_t) list_size * wire_size<Player::id_t>());
+        buff >> list_size;
+        buff.skip((size_t) list_size * wire_size<Position>());
+    }
+
+private:
+    Bomb::id_t id;
+    WireListView<Player::id_t> robots_destroyed;
+    WireListView<Position> blocks_destroyed;
+
+    friend const char *load(const char *src, BombExplodedView &view) {
+        uint32_t list_size;
+        src = load(load(src, view.id), list_size);
+        view.robots_destroyed = WireListView<Player::id_t>(src, list_size);
+        src = load(view.robots_destroyed.get_end(), list_size);
+        view.blocks_destroyed = WireListView<Position>(src, list_size);
+        return view.blocks_destroyed.get_end();
+    }
+};
+
 class PlayerMoved {
 public:
     PlayerMoved() = default;
@@ -213,17 +266,19 @@ public:
 
     Position get_position() const { return position; }
 
+    static constexpr auto wire_fields() { return std::tuple{&PlayerMoved::id, &PlayerMoved::position}; }
+
 private:
     Player::id_t id;
     Position position;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const PlayerMoved &player_moved) {
-        buff << player_moved.id << player_moved.position;
+        buff.write_fixed(player_moved);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, PlayerMoved &player_moved) {
-        buff >> player_moved.id >> player_moved.position;
+        buff.read_fixed(player_moved);
         return buff;
     }
 
@@ -241,16 +296,18 @@ public:
 
     Position get_position() const { return position; }
 
+    static constexpr auto wire_fields() { return std::tuple{&BlockPlaced::position}; }
+
 private:
     Position position;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const BlockPlaced &player_placed) {
-        buff << player_placed.position;
+        buff.write_fixed(player_placed);
         return buff;
     }
 
     friend InBuffer &operator>>(InBuffer &buff, BlockPlaced &player_placed) {
-        buff >> player_placed.position;
+        buff.read_fixed(player_placed);
         return buff;
     }
 
@@ -267,6 +324,20 @@ using Event = std::variant<
     BlockPlaced
 >;
 
+// Event decoded on the fly from a received message, lists are left in place.
+using EventView = std::variant<
+    BombPlaced,
+    BombExplodedView,
+    PlayerMoved,
+    BlockPlaced
+>;
+
+static_assert(wire_size<Position>() == 4);
+static_assert(wire_size<Bomb>() == 6);
+static_assert(wire_size<BombPlaced>() == 8);
+static_assert(wire_size<PlayerMoved>() == 5);
+static_assert(wire_size<std::pair<const Player::id_t, score_t>>() == 5);
+
 std::ostream &operator<<(std::ostream &stream, const Event &event) {
     stream << "Event { ";
     std::visit([&stream](auto const &value){ stream << value; }, event);
@@ -5,8 +5,11 @@
 #include <map>
 #include <set>
 #include <iostream>
+#include <ranges>
+#include <vector>
 
 #include "action.hpp"
+#include "board.hpp"
 #include "event.hpp"
 #include "server.hpp"
 #include "../utils.hpp"
@@ -18,10 +21,17 @@ class Game {
 public:
     Game(Hello &&game_settings, GameStarted &&game_started)
     : game_settings(std::move(game_settings)), turn(0), 
-      players(std::move(game_started.get_players())) {
-        for (const std::pair<Player::id_t, Player> &key_val : players) {
+      players(std::move(game_started.get_players())),
+      blocks(this->game_settings.get_size_x(), this->game_settings.get_size_y()),
+      blocks_by_row(this->game_settings.get_size_y(), this->game_settings.get_size_x()),
+      explosions(this->game_settings.get_size_x(), this->game_settings.get_size_y()),
+      expiring((size_t) this->game_settings.get_bomb_timer() + 1) {
+        for (const std::pair<const Player::id_t, Player> &key_val : players) {
             scores[key_val.first] = 0;
         }
+        header.assign(StringRef{this->game_settings.get_server_name()}, this->game_settings.get_size_x(),
+                      this->game_settings.get_size_y(), this->game_settings.get_game_length());
+        encoded_players.assign(players);
     }
 
     Lobby end_game();
@@ -31,77 +41,125 @@ public:
     }
 
     void process_turn(Turn &&turn) {
-        if (turn.get_turn() != this->turn) {
-            throw std::runtime_error("Turn out of order.");
-        }
-
-        explosions.clear();
-        for (const Event &event : turn.get_events()) {
-            std::visit(visitors {
-                [this](const BombPlaced &bomb_placed) { this->add_bomb(bomb_placed); },
-                [this](const BombExploded &bomb_exploded) { this->process_bomb_explosion(bomb_exploded);  },
-                [this](const PlayerMoved &player_moved) { this->move_player(player_moved); },
-                [this](const BlockPlaced &block_placed) { this->place_block(block_placed); },
-            }, event);
-        }
+        apply_events(turn.get_turn(), turn.get_events());
+    }
 
-        build_state();
+    // Applies the events straight from the receive buffer, without building a Turn first.
+    void process_turn(const TurnView &turn) {
+        apply_events(turn.get_turn(), turn);
     }
 
     void next_turn() {
-        turn++;
-        for (std::pair<const Bomb::id_t, Bomb> &key_val : bomb_map) {
-            key_val.second.decrease_timer();
+        if (expiring[turn % expiring.size()] > 0) {
+            throw std::runtime_error("Bomb not exploded in time.");
         }
+        turn++;
     }
 
 private:
     Hello game_settings;
     game_length_t turn;
-    std::map<Player::id_t, Player> players;
-    std::map<Player::id_t, Position> player_positions;
-    std::list<Position> blocks;
-    std::list<Bomb> bombs;
-    std::set<Position> explosions;
-    std::map<Player::id_t, score_t> scores;
-
-    std::map<Bomb::id_t, Bomb> bomb_map;
-    std::set<Position> block_positions;
-    std::set<Position> blocks_destroyed;
+    PlayerTable<Player> players;
+    PlayerTable<Position> player_positions;
+    Board blocks;
+    // The blocks again with x and y swapped, so that rows are scanned a word at a time like columns.
+    Board blocks_by_row;
+    Board explosions;
+    PlayerTable<score_t> scores;
+
+    // Bombs keep the turn they explode in, their timers are only worked out for the GUI.
+    struct PlacedBomb {
+        Position position;
+        uint32_t explodes_at;
+    };
+
+    std::map<Bomb::id_t, PlacedBomb> bomb_map;
+    /* Timing wheel of live bombs by the turn they explode in, modulo bomb_timer + 1.
+     * The slot of the current turn has to be empty before the game moves on. */
+    std::vector<uint32_t> expiring;
+
+    // The settings and the players do not change during the game, so they are only encoded once.
+    EncodedFragment header;
+    EncodedFragment encoded_players;
 
     void add_bomb(const BombPlaced &bomb_placed) {
-        bomb_map[bomb_placed.get_id()] = Bomb(bomb_placed.get_position(), game_settings.get_bomb_timer());
+        uint32_t explodes_at = (uint32_t) turn + game_settings.get_bomb_timer();
+        auto [bomb_map_it, placed] = bomb_map.try_emplace(bomb_placed.get_id(),
+                                                          PlacedBomb{bomb_placed.get_position(), explodes_at});
+        if (!placed) {
+            expiring[bomb_map_it->second.explodes_at % expiring.size()]--;
+            bomb_map_it->second = PlacedBomb{bomb_placed.get_position(), explodes_at};
+        }
+        expiring[explodes_at % expiring.size()]++;
     }
 
-    bool position_in_map(const Position &position) {
-        return ((position.get_x() < game_settings.get_size_x())
-            &&  (position.get_y() < game_settings.get_size_y()));
+    /* Cells [from, to) of a line of size cells reached by the ray going from v towards
+     * higher coordinates: at most radius of them, up to and including the first block. */
+    std::pair<size_t, size_t> ray_forward(const Board &lines, Position::coord_t line, Position::coord_t v,
+                                          size_t size) {
+        size_t from = (Position::coord_t) (v + 1);
+        if (from >= size)
+            return {0, 0};
+        size_t to = std::min(from + game_settings.get_explosion_radius(), size);
+        size_t block = lines.next_in_column(line, from, to);
+        return {from, std::min(block + 1, to)};
     }
 
-    void mark_explosions_in_direction(Position position, Bomb::explosion_rad_t left, 
-                                      const Direction &direction) {
-        position = position.shift(direction);
-        if (position_in_map(position) && left > 0) {
-            explosions.insert(position);
-            if (block_positions.find(position) == block_positions.end()) {
-                mark_explosions_in_direction(position, left - 1, direction);
-            }
-        }
+    // The same towards lower coordinates.
+    std::pair<size_t, size_t> ray_backward(const Board &lines, Position::coord_t line, Position::coord_t v,
+                                           size_t size) {
+        size_t to = (Position::coord_t) (v - 1) + (size_t) 1;
+        if (to > size)
+            return {0, 0};
+        size_t radius = game_settings.get_explosion_radius();
+        size_t from = to > radius ? to - radius : 0;
+        size_t block = lines.last_in_column(line, from, to);
+        return {block == to ? from : block, to};
     }
 
     void mark_explosions(Position explosion_position) {
         explosions.insert(explosion_position);
-        if (block_positions.find(explosion_position) == block_positions.end()) {
-            for (const Direction &direction : {Direction::Up, Direction::Right, 
-                                               Direction::Down, Direction::Left}) {
-                mark_explosions_in_direction(explosion_position, 
-                                             game_settings.get_explosion_radius(), direction);
+        if (blocks.contains(explosion_position))
+            return;
+
+        Position::coord_t x = explosion_position.get_x();
+        Position::coord_t y = explosion_position.get_y();
+        if (x < game_settings.get_size_x()) {
+            for (auto [from, to] : {ray_forward(blocks, x, y, game_settings.get_size_y()),
+                                    ray_backward(blocks, x, y, game_settings.get_size_y())}) {
+                explosions.insert_in_column(x, from, to);
             }
         }
+        if (y < game_settings.get_size_y()) {
+            for (auto [from, to] : {ray_forward(blocks_by_row, y, x, game_settings.get_size_x()),
+                                    ray_backward(blocks_by_row, y, x, game_settings.get_size_x())}) {
+                for (size_t row_x = from; row_x < to; row_x++)
+                    explosions.insert(Position((Position::coord_t) row_x, y));
+            }
+        }
+    }
+
+    template <typename Events>
+    void apply_events(game_length_t turn, const Events &events) {
+        if (turn != this->turn) {
+            throw std::runtime_error("Turn out of order.");
+        }
+
+        explosions.clear();
+        for (const auto &event : events) {
+            std::visit(visitors {
+                [this](const BombPlaced &bomb_placed) { this->add_bomb(bomb_placed); },
+                [this](const BombExploded &bomb_exploded) { this->process_bomb_explosion(bomb_exploded);  },
+                [this](const BombExplodedView &bomb_exploded) { this->process_bomb_explosion(bomb_exploded);  },
+                [this](const PlayerMoved &player_moved) { this->move_player(player_moved); },
+                [this](const BlockPlaced &block_placed) { this->place_block(block_placed); },
+            }, event);
+        }
     }
 
-    void delete_destroyed_robots(const std::list<Player::id_t> robots_destroyed) {
-        for (const Player::id_t &player_id : robots_destroyed) {
+    template <typename Robots>
+    void delete_destroyed_robots(const Robots &robots_destroyed) {
+        for (Player::id_t player_id : robots_destroyed) {
             auto player_positions_it = player_positions.find(player_id);
             if (player_positions_it != player_positions.end()) {
                 player_positions.erase(player_positions_it);
@@ -110,18 +168,21 @@ private:
         }
     }
 
-    void delete_destroyed_blocks(const std::list<Position> blocks_destroyed) {
-        for (const Position &pos : blocks_destroyed) {
-            if (block_positions.find(pos) != block_positions.end()) {
-                block_positions.erase(block_positions.find(pos));
-            }
+    template <typename Blocks>
+    void delete_destroyed_blocks(const Blocks &blocks_destroyed) {
+        for (Position pos : blocks_destroyed) {
+            blocks.erase(pos);
+            blocks_by_row.erase(Position(pos.get_y(), pos.get_x()));
         }
     }
 
-    void process_bomb_explosion(const BombExploded &bomb_exploded) {
+    // Takes a BombExploded or a BombExplodedView.
+    template <typename Explosion>
+    void process_bomb_explosion(const Explosion &bomb_exploded) {
         auto bomb_map_it = bomb_map.find(bomb_exploded.get_id());
-        Position explosion_position = (bomb_map_it->second).get_position();
+        Position explosion_position = bomb_map_it->second.position;
         mark_explosions(explosion_position);
+        expiring[bomb_map_it->second.explodes_at % expiring.size()]--;
         bomb_map.erase(bomb_map_it);
         delete_destroyed_robots(bomb_exploded.get_robots_destroyed());
         delete_destroyed_blocks(bomb_exploded.get_blocks_destroyed());
@@ -132,41 +193,40 @@ private:
     }
 
     void place_block(const BlockPlaced &block_placed) {
-        block_positions.insert(block_placed.get_position());
+        blocks.insert(block_placed.get_position());
+        blocks_by_row.insert(Position(block_placed.get_position().get_y(), block_placed.get_position().get_x()));
     }
 
-    void build_blocks() {
-        blocks.clear();
-        for (const Position &pos : block_positions) {
-            blocks.push_back(pos);
-        }
-    }
-
-    void build_bombs() {
-        bombs.clear();
-        for (std::pair<const Bomb::id_t, Bomb> &key_val : bomb_map) {
-            bombs.push_back(key_val.second);
-        }
-    }
-
-    void build_state() {
-        build_blocks();
-        build_bombs();
+    // The GUI gets the bombs as a list ordered by id, which is how bomb_map keeps them.
+    auto bombs() const {
+        return std::views::values(bomb_map) | std::views::transform([this](const PlacedBomb &bomb) {
+            return Bomb(bomb.position, (Bomb::timer_t) (bomb.explodes_at - turn));
+        });
     }
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Game &game) {
-        buff << game.game_settings.get_server_name() << game.game_settings.get_size_x() 
-             << game.game_settings.get_size_y() << game.game_settings.get_game_length()
-             << game.turn << game.players << game.player_positions << game.blocks 
-             << game.bombs << game.explosions << game.scores;
+        buff << game.header << game.turn << game.encoded_players << game.player_positions << game.blocks
+             << static_cast<uint32_t>(game.bomb_map.size());
+        buff.write_fixed_elements(game.bombs());
+        buff << game.explosions << game.scores;
         return buff;
     }
 
+    friend size_t encoded_size(const Game &game) {
+        return encoded_size(game.header) + encoded_size(game.turn) + encoded_size(game.encoded_players)
+             + encoded_size(game.player_positions)
+             + encoded_size(game.blocks) + encoded_elements_size(game.bombs()) + encoded_size(game.explosions)
+             + encoded_size(game.scores);
+    }
+
     friend std::ostream &operator<<(std::ostream &stream, const Game &game) {
         stream << "Game { game_settings: " << game.game_settings << ", turn: " << game.turn
                << ", players: " << game.players << ", player_positions: " << game.player_positions
-               << ", blocks: " << game.blocks << ", bombs: " << game.bombs << ", explosions: " << game.explosions
-               << ", scores: " << game.scores << " }";
+               << ", blocks: " << game.blocks << ", bombs: [ ";
+        for (const Bomb &bomb : game.bombs()) {
+            stream << bomb << ", ";
+        }
+        stream << " ], explosions: " << game.explosions << ", scores: " << game.scores << " }";
         return stream; 
     }
 };
@@ -175,7 +235,10 @@ class Lobby {
 public:
     Lobby() = default;
 
-    Lobby(Hello &&game_settings) : game_settings(std::move(game_settings)) {};
+    Lobby(Hello &&game_settings) : game_settings(std::move(game_settings)) {
+        encoded_settings.assign(this->game_settings);
+        encoded_players.assign(players);
+    };
 
     Game start_game(GameStarted &&game_started) {
         return Game(std::move(game_settings), std::move(game_started));
@@ -183,17 +246,26 @@ public:
 
     void add_player(const AcceptedPlayer &&accepted_player) {
         players[accepted_player.get_id()] = accepted_player.get_player();
+        encoded_players.assign(players);
     }
 
 private:
     Hello game_settings;
-    std::map<Player::id_t, Player> players;
+    PlayerTable<Player> players;
+
+    // Encoded again only when they change, not for every frame.
+    EncodedFragment encoded_settings;
+    EncodedFragment encoded_players;
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Lobby &lobby) {
-        buff << lobby.game_settings << lobby.players;
+        buff << lobby.encoded_settings << lobby.encoded_players;
         return buff;
     }
 
+    friend size_t encoded_size(const Lobby &lobby) {
+        return encoded_size(lobby.encoded_settings) + encoded_size(lobby.encoded_players);
+    }
+
     friend std::ostream &operator<<(std::ostream &stream, const Lobby &lobby) {
         stream << "Lobby { game_settings: " << lobby.game_settings 
                << ", players: " << lobby.players << " }";
@@ -4,6 +4,7 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
 #include <variant>
 
 #include "gui.hpp"
@@ -82,12 +83,18 @@ private:
     }
 
     friend OutBuffer &operator<<(OutBuffer &buff, const Hello &hello) {
-        buff << hello.server_name << hello.players_count
+        buff << StringRef{hello.server_name} << hello.players_count
              << hello.size_x << hello.size_y << hello.game_length
              << hello.explosion_radius << hello.bomb_timer;
         return buff;
     }
 
+    friend size_t encoded_size(const Hello &hello) {
+        return encoded_size(hello.server_name) + encoded_size(hello.players_count)
+             + encoded_size(hello.size_x) + encoded_size(hello.size_y) + encoded_size(hello.game_length)
+             + encoded_size(hello.explosion_radius) + encoded_size(hello.bomb_timer);
+    }
+
     friend std::ostream &operator<<(std::ostream &stream, [[maybe_unused]] const Hello &hello) {
         stream << "Hello { server_name: " << hello.server_name 
                << ", players_count: " << hello.players_count
@@ -135,19 +142,19 @@ class GameStarted {
 public:
     GameStarted() = default;
 
-    GameStarted(std::map<Player::id_t, Player> players) : players(players) {}
+    GameStarted(PlayerTable<Player> players) : players(std::move(players)) {}
 
-    std::map<Player::id_t, Player> &get_players() { return players; }
+    PlayerTable<Player> &get_players() { return players; }
 
 private:
-    std::map<Player::id_t, Player> players;
+    PlayerTable<Player> players;
 
     friend InBuffer &operator>>(InBuffer &buff, GameStarted &game_started) {
         buff >> game_started.players;
         return buff;
     }
 
-    friend OutBuffer &operator>>(OutBuffer &buff, const GameStarted &game_started) {
+    friend OutBuffer &operator<<(OutBuffer &buff, const GameStarted &game_started) {
         buff << game_started.players;
         return buff;
     }
@@ -162,22 +169,22 @@ class Turn {
 public:
     Turn() = default;
 
-    Turn(game_length_t turn, std::list<Event> events) : turn(turn), events(events) {}
+    Turn(game_length_t turn, std::vector<Event> events) : turn(turn), events(std::move(events)) {}
 
     game_length_t get_turn() { return turn; }
 
-    const std::list<Event> &get_events() { return events; }
+    const std::vector<Event> &get_events() { return events; }
 
 private:
     game_length_t turn;
-    std::list<Event> events;
+    std::vector<Event> events;
 
     friend InBuffer &operator>>(InBuffer &buff, Turn &turn) {
         buff >> turn.turn >> turn.events;
         return buff;
     }
 
-    friend OutBuffer &operator>>(OutBuffer &buff, const Turn &turn) {
+    friend OutBuffer &operator<<(OutBuffer &buff, const Turn &turn) {
         buff << turn.turn << turn.events;
         return buff;
     }
@@ -188,21 +195,103 @@ private:
     }
 };
 
+/* Turn decoded lazily. Decoding it only checks that all of it has arrived and is
+ * well-formed, the events are decoded straight from the receive buffer while being
+ * iterated over. It is valid until the next message is decoded from the same buffer. */
+class TurnView {
+public:
+    class iterator {
+    public:
+        using value_type = EventView;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const EventView *;
+        using reference = const EventView &;
+        using iterator_category = std::input_iterator_tag;
+
+        iterator() = default;
+
+        iterator(const char *src, uint32_t left) : src(src), left(left) {
+            if (left > 0)
+                load_event();
+        }
+
+        const EventView &operator*() const { return event; }
+
+        const EventView *operator->() const { return &event; }
+
+        iterator &operator++() {
+            if (--left > 0)
+                load_event();
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(const iterator &other) const { return left == other.left; }
+
+    private:
+        const char *src = nullptr;
+        uint32_t left = 0;
+        EventView event;
+
+        void load_event() {
+            uint8_t index;
+            src = load(src, index);
+            src = load_alternative(src, index, event);
+        }
+    };
+
+    TurnView() = default;
+
+    game_length_t get_turn() const { return turn; }
+
+    size_t size() const { return events_count; }
+
+    iterator begin() const { return iterator(events, events_count); }
+
+    iterator end() const { return iterator(); }
+
+private:
+    game_length_t turn;
+    uint32_t events_count = 0;
+    const char *events = nullptr;
+
+    friend InBuffer &operator>>(InBuffer &buff, TurnView &turn) {
+        buff >> turn.turn >> turn.events_count;
+        size_t events_offset = buff.get_message_offset();
+        for (uint32_t i = 0; i < turn.events_count && buff.ok(); i++) {
+            uint8_t index;
+            buff >> index;
+            if (buff.ok() && !skip_from_index<EventView>(buff, index)) {
+                buff.fail(DecodeError::UnknownType);
+            }
+        }
+        // Only now, the buffer may have moved its data while the rest was arriving.
+        turn.events = buff.get_message_data(events_offset);
+        return buff;
+    }
+
+    friend std::ostream &operator<<(std::ostream &stream, const TurnView &turn) {
+        stream << "TurnView { turn: " << turn.turn << ", events: " << turn.events_count << " }";
+        return stream;
+    }
+};
+
 class GameEnded {
 public:
     GameEnded() = default;
 
-    GameEnded(std::map<Player::id_t, score_t> scores) : scores(scores) {}
+    GameEnded(PlayerTable<score_t> scores) : scores(std::move(scores)) {}
 
 private:
-    std::map<Player::id_t, score_t> scores;
+    PlayerTable<score_t> scores;
 
     friend InBuffer &operator>>(InBuffer &buff, GameEnded &game_ended) {
         buff >> game_ended.scores;
         return buff;
     }
 
-    friend OutBuffer &operator>>(OutBuffer &buff, const GameEnded &game_ended) {
+    friend OutBuffer &operator<<(OutBuffer &buff, const GameEnded &game_ended) {
         buff << game_ended.scores;
         return buff;
     }
@@ -228,4 +317,13 @@ std::ostream &operator<<(std::ostream &stream, const ServerMessage &server_messa
     return stream;
 }
 
+// Same messages on the wire as ServerMessage, but turns are left in the receive buffer.
+using ServerMessageView = std::variant<
+    Hello,
+    AcceptedPlayer,
+    GameStarted,
+    TurnView,
+    GameEnded
+>;
+
 #endif // __SERVER_CLIENT_H__
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef __MOVE_COALESCER_H__
+#define __MOVE_COALESCER_H__
+
+#include <chrono>
+#include <optional>
+#include <utility>
+
+/* The server only acts on the last move of a turn, so a move held for it is replaced
+ * by a newer one. It is sent once the next turn arrives or, with a deadline, once it
+ * has been held that long. Not synchronized, the client guards it with a mutex.
+ * The clock is only a parameter for tests. */
+template <typename Move, typename Clock = std::chrono::steady_clock>
+class MoveCoalescer {
+public:
+    MoveCoalescer(typename Clock::duration deadline = {}) : deadline(deadline) {}
+
+    // Returns true if no move was held before, its deadline starts then.
+    bool hold(Move move) {
+        bool first = !held;
+        if (first) {
+            held_since = Clock::now();
+        } else {
+            dropped++;
+        }
+        held = std::move(move);
+        return first;
+    }
+
+    // The held move, if any, to be sent now.
+    std::optional<Move> take() {
+        std::optional<Move> move = std::move(held);
+        held.reset();
+        sent += move.has_value();
+        return move;
+    }
+
+    // The held move, only once it has been held for the deadline.
+    std::optional<Move> take_due() {
+        if (!held || Clock::now() < get_deadline())
+            return {};
+        return take();
+    }
+
+    // A move held for a game that ended is not sent.
+    void drop() {
+        dropped += held.has_value();
+        held.reset();
+    }
+
+    bool is_holding() const { return held.has_value(); }
+
+    bool has_deadline() const { return deadline > deadline.zero(); }
+
+    typename Clock::time_point get_deadline() const { return held_since + deadline; }
+
+    size_t get_sent() const { return sent; }
+
+    size_t get_dropped() const { return dropped; }
+
+private:
+    typename Clock::duration deadline;
+    std::optional<Move> held;
+    typename Clock::time_point held_since;
+    size_t sent = 0;
+    size_t dropped = 0;
+};
+
+#endif // __MOVE_COALESCER_H__
@@ -3,6 +3,7 @@
 
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <vector>
 
 #include "utils.hpp"
 
@@ -42,16 +43,26 @@ private:
 
 // Parses robots-client args
 bool parse_args(int argc, const char *argv[],
-                EndPoint &gui_endpoint, EndPoint &server_endpoint,
-                uint16_t &port, std::string &player_name) {
+                std::vector<EndPoint> &gui_endpoints, EndPoint &server_endpoint,
+                uint16_t &port, std::string &player_name, bool &coroutines,
+                bool &io_uring, bool &coalesce_inputs, uint32_t &coalesce_deadline) {
     
-    std::string server_addr_str, gui_addr_str;
+    std::string server_addr_str;
+    std::vector<std::string> gui_addr_strs;
     try {
         program_options::options_description desc("Allowed options");
         desc.add_options()
-            ("gui-address,d", program_options::value<std::string>(&gui_addr_str)->required(), 
-            "<(host name):(port) | (IPv4):(port) | (IPv6):(port)>")
+            ("gui-address,d", program_options::value<std::vector<std::string>>(&gui_addr_strs)->required(), 
+            "<(host name):(port) | (IPv4):(port) | (IPv6):(port)> - repeat to send frames to several GUIs")
+            ("coalesce-inputs,i", program_options::bool_switch(&coalesce_inputs),
+            "send only the latest move of each turn to the server (ignored with coroutines)")
+            ("coalesce-deadline", program_options::value<uint32_t>(&coalesce_deadline)->default_value(0),
+            "<ms> - with --coalesce-inputs, also send a move once it has been held this long (0 - never)")
+            ("coroutines,c", program_options::bool_switch(&coroutines),
+            "handle the GUI and the server with coroutines on a single thread")
             ("help,h", "produce help message")
+            ("io-uring,u", program_options::bool_switch(&io_uring),
+            "use io_uring for socket I/O when available (ignored with coroutines)")
             ("player-name,n", program_options::value<std::string>(&player_name)->required(), "<String>")
             ("port,p", program_options::value<uint16_t>(&port)->required(), "<u16> - client listens to GUI on that port")
             ("server-address,s", program_options::value<std::string>(&server_addr_str)->required(), 
@@ -73,7 +84,9 @@ bool parse_args(int argc, const char *argv[],
         return false;
     }
 
-    gui_endpoint = EndPoint(gui_addr_str);
+    for (const std::string &gui_addr_str : gui_addr_strs) {
+        gui_endpoints.push_back(EndPoint(gui_addr_str));
+    }
     server_endpoint = EndPoint(server_addr_str);
 
     return true;
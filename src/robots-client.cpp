@@ -8,13 +8,24 @@ using boost::asio::ip::tcp;
 
 int main(int argc, const char *argv[]) {
     std::string player_name;
-    EndPoint gui_endpoint, server_endpoint;
+    std::vector<EndPoint> gui_endpoints;
+    EndPoint server_endpoint;
     uint16_t port;
+    bool coroutines;
+    bool io_uring;
+    bool coalesce_inputs;
+    uint32_t coalesce_deadline;
 
-    if(!parse_args(argc, argv, gui_endpoint, server_endpoint, port, player_name)) {
+    if(!parse_args(argc, argv, gui_endpoints, server_endpoint, port, player_name, coroutines,
+                    io_uring, coalesce_inputs, coalesce_deadline)) {
         return 1;
     }
 
-    Client client(player_name, server_endpoint, gui_endpoint, port);
-    client.run();
+    Client client(player_name, server_endpoint, gui_endpoints, port, io_uring && !coroutines,
+                  coalesce_inputs && !coroutines, std::chrono::milliseconds(coalesce_deadline));
+    if (coroutines) {
+        client.run_coroutines();
+    } else {
+        client.run();
+    }
 }
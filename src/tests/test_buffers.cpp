@@ -0,0 +1,357 @@
+#include <utility>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../buffers/inbuffers.hpp"
+#include "../buffers/outbuffers.hpp"
+#include "../buffers/transports.hpp"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+/* More referenced strings than a send can gather. The ones past the segment limit
+ * have to be copied, leaving room for the data written after them. */
+bool test_refs_past_segment_limit() {
+    boost::asio::io_context io_context;
+    udp::socket receiver(io_context, udp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    udp::socket sender(io_context, udp::endpoint(udp::v6(), 0));
+    MmsgUDPOutTransport transport(sender, {receiver.local_endpoint()});
+    UDPOutBuffer buff(transport);
+
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 100; i++)
+        names.push_back(std::string(20 + i % 7, (char) ('a' + i % 26)));
+
+    std::string expected;
+    for (const std::string &name : names) {
+        buff << StringRef{name};
+        expected += (char) name.size();
+        expected += name;
+    }
+    buff << (uint16_t) 0xabcd;
+    expected += "\xab\xcd";
+
+    size_t segments = buff.get_buffers().size();
+    if (segments > OutBuffer::MAX_SEGMENTS) {
+        std::cerr << "test_refs_past_segment_limit: " << segments << " segments, at most "
+                  << OutBuffer::MAX_SEGMENTS << " are gathered\n";
+        return false;
+    }
+
+    buff.send();
+    std::string received(expected.size() + 1, '\0');
+    received.resize(receiver.receive(boost::asio::buffer(received)));
+    if (received != expected) {
+        std::cerr << "test_refs_past_segment_limit: sent " << received.size() << " bytes, expected "
+                  << expected.size() << "\n";
+        return false;
+    }
+    return true;
+}
+
+/* Sends big enough to fill the socket buffers, while the peer reads slowly,
+ * have to arrive in the order they were made. */
+bool test_uring_stream_order() {
+    std::unique_ptr<Uring> ring = Uring::create();
+    if (!ring)
+        return true;
+
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    tcp::socket sender(io_context);
+    sender.connect(acceptor.local_endpoint());
+    tcp::socket receiver = acceptor.accept();
+    sender.set_option(tcp::socket::send_buffer_size(4096));
+    UringOutTransport transport(*ring, sender.native_handle(), true);
+
+    const size_t SENDS = 64;
+    const size_t SEND_SIZE = 1 << 16;
+    bool in_order = true;
+    std::thread reader([&]() {
+        std::vector<char> block(SEND_SIZE);
+        for (size_t i = 0; i < SENDS; i++) {
+            if (i % 8 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            boost::asio::read(receiver, boost::asio::buffer(block));
+            in_order &= block.front() == (char) i && block.back() == (char) i;
+        }
+    });
+
+    std::vector<char> block(SEND_SIZE);
+    for (size_t i = 0; i < SENDS; i++) {
+        std::fill(block.begin(), block.end(), (char) i);
+        transport.send({boost::asio::buffer(block)});
+    }
+    transport.flush();
+    reader.join();
+
+    if (!in_order)
+        std::cerr << "test_uring_stream_order: bytes arrived out of order\n";
+    return in_order;
+}
+
+// A send on a closed connection is thrown by a later send.
+bool test_uring_stream_error() {
+    std::unique_ptr<Uring> ring = Uring::create();
+    if (!ring)
+        return true;
+
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    tcp::socket sender(io_context);
+    sender.connect(acceptor.local_endpoint());
+    acceptor.accept().close();
+    UringOutTransport transport(*ring, sender.native_handle(), true);
+
+    std::vector<char> block(1024);
+    for (size_t i = 0; i < 100; i++) {
+        try {
+            transport.send({boost::asio::buffer(block)});
+        } catch (boost::system::system_error &) {
+            return true;
+        }
+        ring->wait(0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::cerr << "test_uring_stream_error: sends on a closed connection did not fail\n";
+    return false;
+}
+
+// Remembers what was sent through it.
+class RecordingOutTransport : public OutTransport {
+public:
+    std::string sent;
+
+    virtual void send(const std::vector<boost::asio::const_buffer> &buffers) {
+        size_t end = sent.size();
+        sent.resize(end + boost::asio::buffer_size(buffers));
+        boost::asio::buffer_copy(boost::asio::buffer(sent.data() + end, sent.size() - end), buffers);
+    }
+
+    virtual size_t get_memory_usage() { return sizeof(*this); }
+};
+
+/* A full queue drops messages, but still takes one that must not be dropped.
+ * The queue is written through the transport. */
+bool test_full_queue_keeps_join() {
+    RecordingOutTransport transport;
+    TCPOutBuffer buff(transport);
+    std::string block(TCPOutBuffer::MAX_QUEUED, 'm');
+    buff.write_data(block.data(), block.size());
+    bool queued = buff.queue();
+    buff << (uint8_t) 1;
+    bool dropped = !buff.queue();
+    buff << (uint8_t) 2;
+    bool kept = buff.queue(false);
+    buff << (uint8_t) 3;
+    bool repeat_dropped = !buff.queue(false);
+    if (!queued || !dropped || !kept || !repeat_dropped || buff.get_dropped() != 2) {
+        std::cerr << "test_full_queue_keeps_join: only the message that must not be dropped "
+                  << "should be queued past the limit\n";
+        return false;
+    }
+
+    buff.close_queue();
+    buff.write_queue();
+    if (transport.sent != block + "\x02") {
+        std::cerr << "test_full_queue_keeps_join: the transport got " << transport.sent.size()
+                  << " bytes, expected " << block.size() + 1 << "\n";
+        return false;
+    }
+    return true;
+}
+
+// Messages queued while the writer sends on a ring arrive whole and in order.
+bool test_uring_write_queue() {
+    std::unique_ptr<Uring> ring = Uring::create();
+    if (!ring)
+        return true;
+
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    tcp::socket sender(io_context);
+    sender.connect(acceptor.local_endpoint());
+    tcp::socket receiver = acceptor.accept();
+    UringOutTransport transport(*ring, sender.native_handle(), true);
+    TCPOutBuffer buff(transport);
+
+    // Few enough that none is dropped for a full queue.
+    const uint32_t MESSAGES = 10000;
+    std::thread writer([&]() { buff.write_queue(); });
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        buff << i;
+        buff.queue();
+    }
+    buff.close_queue();
+
+    std::vector<char> received(MESSAGES * sizeof(uint32_t));
+    boost::asio::read(receiver, boost::asio::buffer(received));
+    writer.join();
+    MemoryInBuffer in(std::string(received.begin(), received.end()));
+    for (uint32_t i = 0; i < MESSAGES; i++) {
+        uint32_t message;
+        in >> message;
+        if (message != i) {
+            std::cerr << "test_uring_write_queue: message " << i << " arrived as " << message << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool expect_error(const char *test, DecodeError error, DecodeError expected) {
+    if (error != expected) {
+        std::cerr << test << ": got \"" << describe(error) << "\", expected \""
+                  << describe(expected) << "\"\n";
+        return false;
+    }
+    return true;
+}
+
+bool test_unknown_variant_index() {
+    MemoryInBuffer buff(std::string("\x02\x00\x01", 3));
+    std::variant<uint8_t, uint16_t> variant;
+    return expect_error("test_unknown_variant_index", decode(buff, variant), DecodeError::UnknownType);
+}
+
+// A datagram with bytes left after its message is dropped whole.
+bool test_trailing_datagram_bytes() {
+    boost::asio::io_context io_context;
+    udp::socket receiver(io_context, udp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    udp::socket sender(io_context, udp::endpoint(udp::v6(), 0));
+    AsioInTransport<udp::socket> transport(receiver);
+    UDPInBuffer buff(receiver, transport);
+
+    sender.send_to(boost::asio::buffer(std::string("\x01\x00\x07\x2a", 4)), receiver.local_endpoint());
+    sender.send_to(boost::asio::buffer(std::string("\x01\x00\x07", 3)), receiver.local_endpoint());
+    std::variant<uint8_t, uint16_t> variant;
+    if (!expect_error("test_trailing_datagram_bytes", decode(buff, variant), DecodeError::TrailingData))
+        return false;
+    if (!expect_error("test_trailing_datagram_bytes", decode(buff, variant), DecodeError::None))
+        return false;
+    if (std::get<uint16_t>(variant) != 7) {
+        std::cerr << "test_trailing_datagram_bytes: the next datagram decoded wrong\n";
+        return false;
+    }
+    return true;
+}
+
+// A map cut short keeps only the entries that were decoded whole.
+bool test_short_map() {
+    MemoryInBuffer buff(std::string("\x00\x00\x00\x02" "\x01\x02hi" "\x02\x05" "ab", 12));
+    std::map<uint8_t, std::string> map;
+    if (!expect_error("test_short_map", decode(buff, map), DecodeError::NotEnoughData))
+        return false;
+    if (map.size() != 1 || map[1] != "hi") {
+        std::cerr << "test_short_map: " << map.size() << " entries kept, expected only the first\n";
+        return false;
+    }
+    return true;
+}
+
+bool test_short_table() {
+    MemoryInBuffer buff(std::string("\x00\x00\x00\x02" "\x01\x02hi" "\x02\x05" "ab", 12));
+    IdTable<uint8_t, std::string> table;
+    if (!expect_error("test_short_table", decode(buff, table), DecodeError::NotEnoughData))
+        return false;
+    if (table.size() != 1 || table.contains(2)) {
+        std::cerr << "test_short_table: " << table.size() << " entries kept, expected only the first\n";
+        return false;
+    }
+    return true;
+}
+
+/* A sparse table keeps its entries in id order whatever order they come in,
+ * like the map it stands in for, and encodes the same. */
+bool test_sparse_table() {
+    std::mt19937 random(17);
+    SparseIdTable<uint8_t, std::string> table;
+    std::map<uint8_t, std::string> map;
+    for (size_t i = 0; i < 2000; i++) {
+        uint8_t key = (uint8_t) random();
+        if (random() % 3 == 0) {
+            table.erase(key);
+            map.erase(key);
+        } else {
+            table[key] = map[key] = std::to_string(i);
+        }
+
+        SparseIdTable<uint8_t, std::string> copy;
+        copy = table;
+        MemoryOutBuffer table_buff, map_buff;
+        table_buff << copy;
+        map_buff << map;
+        std::string encoded = table_buff.take();
+        if (encoded != map_buff.take() || copy.size() != map.size()) {
+            std::cerr << "test_sparse_table: differs from a map after " << i + 1 << " changes\n";
+            return false;
+        }
+
+        MemoryInBuffer in(encoded);
+        SparseIdTable<uint8_t, std::string> decoded;
+        if (decode(in, decoded) != DecodeError::None || !std::equal(decoded.begin(), decoded.end(),
+                                                                     map.begin(), map.end())) {
+            std::cerr << "test_sparse_table: decoded differently from a map after " << i + 1 << " changes\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A non-blocking buffer reports a message that has only partly arrived,
+ * and decodes it whole once the rest is buffered. */
+bool test_incomplete_tcp_message() {
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0));
+    tcp::socket sender(io_context);
+    sender.connect(acceptor.local_endpoint());
+    tcp::socket receiver = acceptor.accept();
+    AsioInTransport<tcp::socket> transport(receiver);
+    TCPInBuffer buff(receiver, transport);
+    buff.set_blocking(false);
+
+    std::string message("\x00\x00\x00\x02" "\x01\x02hi" "\x02\x02" "ab", 12);
+    boost::asio::write(sender, boost::asio::buffer(message.data(), 7));
+    while (receiver.available() < 7)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::map<uint8_t, std::string> map;
+    buff.read_pending();
+    if (!expect_error("test_incomplete_tcp_message", decode(buff, map), DecodeError::Incomplete))
+        return false;
+
+    boost::asio::write(sender, boost::asio::buffer(message.data() + 7, message.size() - 7));
+    while (receiver.available() < message.size() - 7)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    buff.rewind();
+    buff.read_pending();
+    if (!expect_error("test_incomplete_tcp_message", decode(buff, map), DecodeError::None))
+        return false;
+    if (map.size() != 2 || map[2] != "ab") {
+        std::cerr << "test_incomplete_tcp_message: the completed message decoded wrong\n";
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed &= test_refs_past_segment_limit();
+    passed &= test_uring_stream_order();
+    passed &= test_uring_stream_error();
+    passed &= test_unknown_variant_index();
+    passed &= test_trailing_datagram_bytes();
+    passed &= test_short_map();
+    passed &= test_short_table();
+    passed &= test_sparse_table();
+    passed &= test_incomplete_tcp_message();
+    passed &= test_full_queue_keeps_join();
+    passed &= test_uring_write_queue();
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include <utility>
+#include <boost/asio.hpp>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../client.hpp"
+#include "../move_coalescer.hpp"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+template <typename T>
+std::string encode(const T &val) {
+    MemoryOutBuffer buff;
+    buff << val;
+    return buff.take();
+}
+
+// Server messages recorded in memory. Once they run out, the server is gone.
+class RecordedServer {
+public:
+    RecordedServer(const std::string &bytes) : buff(bytes) {}
+
+    DecodeError try_receive(ServerMessageView &message) {
+        if (buff.get_left() == 0)
+            return DecodeError::Incomplete;
+        return decode(buff, message);
+    }
+
+private:
+    MemoryInBuffer buff;
+
+    friend RecordedServer &operator>>(RecordedServer &server, ServerMessageView &message) {
+        if (decode(server.buff, message) != DecodeError::None)
+            throw std::runtime_error("Server gone.");
+        return server;
+    }
+};
+
+/* A client connected to a server that only says hello, drawing for a GUI socket of the
+ * test. The rest of what the server says is recorded and fed to it afterwards. */
+class TestClient {
+public:
+    TestClient()
+    : acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v6::loopback(), 0)),
+      gui(io_context, udp::endpoint(boost::asio::ip::address_v6::loopback(), 0)) {
+        std::thread server([this]() {
+            tcp::socket socket = acceptor.accept();
+            boost::asio::write(socket, boost::asio::buffer(encode(ServerMessage(settings))));
+        });
+        client = std::make_unique<Client>("test", endpoint(acceptor.local_endpoint().port()),
+                                          std::vector<EndPoint>{endpoint(gui.local_endpoint().port())}, 0);
+        server.join();
+    }
+
+    Hello settings = Hello("test", 2, 10, 10, 1000, 2, 3);
+
+    Client &get() { return *client; }
+
+    // Turns of the frames drawn so far, -1 for a lobby.
+    std::vector<int> drawn_turns() {
+        std::vector<int> turns;
+        std::string frame(UDPBuffer::MAX_DATAGRAM_SIZE, '\0');
+        while (gui.available() > 0) {
+            MemoryInBuffer buff(frame.substr(0, gui.receive(boost::asio::buffer(frame))));
+            uint8_t index;
+            std::string server_name;
+            Position::coord_t size_x, size_y;
+            game_length_t game_length, turn;
+            buff >> index >> server_name >> size_x >> size_y >> game_length >> turn;
+            turns.push_back(index == 0 ? -1 : turn);
+        }
+        return turns;
+    }
+
+private:
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor;
+    udp::socket gui;
+    std::unique_ptr<Client> client;
+
+    static EndPoint endpoint(uint16_t port) {
+        return EndPoint("[::1]:" + std::to_string(port));
+    }
+};
+
+std::string record_turns(game_length_t turns) {
+    std::string recorded = encode(ServerMessage(GameStarted({
+        {0, Player("test", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}})));
+    for (game_length_t turn = 0; turn < turns; turn++) {
+        recorded += encode(ServerMessage(Turn(turn, {
+            PlayerMoved(0, Position((Position::coord_t) (turn % 10), 0)),
+            BlockPlaced(Position((Position::coord_t) (turn % 10), 5))})));
+    }
+    return recorded;
+}
+
+std::string describe(const std::vector<int> &turns) {
+    std::string described;
+    for (int turn : turns)
+        described += " " + (turn < 0 ? std::string("lobby") : std::to_string(turn));
+    return described;
+}
+
+// Turns that have all arrived by the time the client gets to them are drawn once, as the newest.
+bool test_backlog_draws_newest() {
+    TestClient client;
+    RecordedServer server(record_turns(20));
+    client.get().listen_to_server(server);
+    std::vector<int> turns = client.drawn_turns();
+    if (turns != std::vector<int>{-1, 19}) {
+        std::cerr << "test_backlog_draws_newest: drew" << describe(turns) << ", expected lobby 19\n";
+        return false;
+    }
+    return true;
+}
+
+// A server that goes away mid-backlog still gets the newest state drawn.
+bool test_disconnect_draws_pending() {
+    TestClient client;
+    RecordedServer server(record_turns(20) + "\x09");
+    client.get().listen_to_server(server);
+    std::vector<int> turns = client.drawn_turns();
+    if (turns != std::vector<int>{-1, 19}) {
+        std::cerr << "test_disconnect_draws_pending: drew" << describe(turns) << ", expected lobby 19\n";
+        return false;
+    }
+    return true;
+}
+
+// A clock that only moves when told to.
+struct FakeClock {
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<FakeClock>;
+    static constexpr bool is_steady = true;
+
+    static inline time_point current;
+
+    static time_point now() { return current; }
+};
+
+std::string describe(const std::optional<ClientMessage> &move) {
+    if (!move)
+        return "nothing";
+    std::ostringstream described;
+    described << *move;
+    return described.str();
+}
+
+bool expect_move(const char *test, const std::optional<ClientMessage> &move, const std::optional<ClientMessage> &expected) {
+    if (describe(move) != describe(expected)) {
+        std::cerr << test << ": got " << describe(move) << ", expected " << describe(expected) << "\n";
+        return false;
+    }
+    return true;
+}
+
+// A held move goes out once the deadline passes, counted from when it was first held.
+bool test_move_sent_at_deadline() {
+    MoveCoalescer<ClientMessage, FakeClock> coalescer(std::chrono::milliseconds(200));
+    FakeClock::current = {};
+    coalescer.hold(Move(Direction::Up));
+    FakeClock::current += std::chrono::milliseconds(150);
+    coalescer.hold(Move(Direction::Left));
+    FakeClock::current += std::chrono::milliseconds(49);
+    if (!expect_move("test_move_sent_at_deadline", coalescer.take_due(), std::nullopt))
+        return false;
+    FakeClock::current += std::chrono::milliseconds(1);
+    if (!expect_move("test_move_sent_at_deadline", coalescer.take_due(), Move(Direction::Left)))
+        return false;
+    // The next move waits for a deadline of its own.
+    coalescer.hold(PlaceBomb());
+    FakeClock::current += std::chrono::milliseconds(199);
+    if (!expect_move("test_move_sent_at_deadline", coalescer.take_due(), std::nullopt))
+        return false;
+    FakeClock::current += std::chrono::milliseconds(1);
+    return expect_move("test_move_sent_at_deadline", coalescer.take_due(), PlaceBomb());
+}
+
+// Within a turn a newer move replaces the one held, only the newest is sent when the turn ends.
+bool test_newer_move_replaces_held() {
+    MoveCoalescer<ClientMessage, FakeClock> coalescer(std::chrono::milliseconds(200));
+    FakeClock::current = {};
+    coalescer.hold(Move(Direction::Up));
+    coalescer.hold(PlaceBlock());
+    coalescer.hold(Move(Direction::Down));
+    if (!expect_move("test_newer_move_replaces_held", coalescer.take(), Move(Direction::Down))
+        || !expect_move("test_newer_move_replaces_held", coalescer.take(), std::nullopt))
+        return false;
+    if (coalescer.get_sent() != 1 || coalescer.get_dropped() != 2) {
+        std::cerr << "test_newer_move_replaces_held: " << coalescer.get_sent() << " sent and "
+                  << coalescer.get_dropped() << " dropped, expected 1 and 2\n";
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed &= test_backlog_draws_newest();
+    passed &= test_disconnect_draws_pending();
+    passed &= test_move_sent_at_deadline();
+    passed &= test_newer_move_replaces_held();
+    return passed ? 0 : 1;
+}
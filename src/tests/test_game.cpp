@@ -0,0 +1,485 @@
+/* GCC 12 cannot tell that a small_vector taken over by BombExploded only moves
+ * its elements with memmove while they fit inline, and warns about reading past them. */
+#pragma GCC diagnostic ignored "-Wstringop-overread"
+
+#include <utility>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../buffers/inbuffers.hpp"
+#include "../buffers/outbuffers.hpp"
+#include "../messages/gui.hpp"
+
+using boost::asio::ip::tcp;
+
+using Cells = std::vector<std::pair<Position::coord_t, Position::coord_t>>;
+
+// A Game frame as the GUI decodes it.
+struct Frame {
+    std::string server_name;
+    Position::coord_t size_x;
+    Position::coord_t size_y;
+    game_length_t game_length;
+    game_length_t turn;
+    std::map<Player::id_t, Player> players;
+    std::map<Player::id_t, Position> player_positions;
+    std::vector<Position> blocks;
+    std::vector<std::pair<Position, Bomb::timer_t>> bombs;
+    std::vector<Position> explosions;
+    std::map<Player::id_t, score_t> scores;
+
+    friend InBuffer &operator>>(InBuffer &buff, Frame &frame) {
+        buff >> frame.server_name >> frame.size_x >> frame.size_y >> frame.game_length >> frame.turn
+             >> frame.players >> frame.player_positions >> frame.blocks >> frame.bombs
+             >> frame.explosions >> frame.scores;
+        return buff;
+    }
+};
+
+template <typename T>
+std::string encode(const T &val) {
+    MemoryOutBuffer buff;
+    buff << val;
+    return buff.take();
+}
+
+Frame draw(const Game &game) {
+    MemoryInBuffer buff(encode(game));
+    Frame frame;
+    if (decode(buff, frame) != DecodeError::None || buff.get_left() > 0)
+        throw std::runtime_error("Frame not decoded.");
+    return frame;
+}
+
+template <typename Positions>
+Cells cells(const Positions &positions) {
+    Cells cells;
+    for (Position position : positions)
+        cells.emplace_back(position.get_x(), position.get_y());
+    return cells;
+}
+
+Game start_game(Position::coord_t size_x, Position::coord_t size_y, Bomb::explosion_rad_t radius,
+                Bomb::timer_t bomb_timer) {
+    return Lobby(Hello("test", 2, size_x, size_y, 60000, radius, bomb_timer)).start_game(GameStarted({
+        {0, Player("Alice", "[::1]:1111")}, {1, Player("Bob", "[::1]:2222")}}));
+}
+
+bool on_board(Position position, Position::coord_t size_x, Position::coord_t size_y) {
+    return position.get_x() < size_x && position.get_y() < size_y;
+}
+
+/* Cells hit by a bomb, walked one by one the way the set-based game did it.
+ * Only cells on the board are kept, as the board cannot hold any other. */
+std::set<Position> reference_explosion(const std::set<Position> &blocks, Position bomb,
+                                       Position::coord_t size_x, Position::coord_t size_y,
+                                       Bomb::explosion_rad_t radius) {
+    std::set<Position> explosion;
+    if (on_board(bomb, size_x, size_y))
+        explosion.insert(bomb);
+    if (blocks.contains(bomb))
+        return explosion;
+    for (Direction direction : {Direction::Up, Direction::Right, Direction::Down, Direction::Left}) {
+        Position position = bomb;
+        for (size_t left = radius; left > 0; left--) {
+            position = position.shift(direction);
+            if (!on_board(position, size_x, size_y))
+                break;
+            explosion.insert(position);
+            if (blocks.contains(position))
+                break;
+        }
+    }
+    return explosion;
+}
+
+/* Bombs on boards of all shapes, in and around blocks, next to the edges and to word
+ * boundaries of the bitmap, and off the board, where a coordinate wraps to the other edge. */
+bool test_explosions() {
+    struct Case {
+        Position::coord_t size_x;
+        Position::coord_t size_y;
+        Bomb::explosion_rad_t radius;
+        size_t blocks_percent;
+    };
+    const std::vector<Case> cases = {
+        {1, 1, 0, 0}, {1, 1, 3, 0}, {2, 2, 1, 50}, {64, 64, 5, 30}, {63, 65, 70, 10},
+        {128, 2, 200, 5}, {2, 128, 127, 20}, {129, 129, 64, 40}, {200, 3, 65535, 0},
+        {100, 100, 1, 60}, {65535, 1, 65535, 1}, {1, 65535, 1000, 1},
+    };
+
+    for (size_t i = 0; i < cases.size(); i++) {
+        const Case &test = cases[i];
+        std::mt19937 random((unsigned) i);
+        auto random_position = [&]() {
+            return Position((Position::coord_t) (random() % test.size_x),
+                            (Position::coord_t) (random() % test.size_y));
+        };
+        size_t cells_count = (size_t) test.size_x * test.size_y;
+        auto cell_position = [&](size_t cell) {
+            cell = std::min(cell, cells_count - 1);
+            return Position((Position::coord_t) (cell / test.size_y), (Position::coord_t) (cell % test.size_y));
+        };
+
+        std::vector<Position> bombs = {
+            cell_position(0), cell_position(63), cell_position(64), cell_position(127), cell_position(128),
+            cell_position(cells_count - 1), Position(test.size_x, 0), Position(0, test.size_y),
+            Position(65535, random_position().get_y()), Position(random_position().get_x(), 65535),
+            Position(65535, 65535),
+        };
+        while (bombs.size() < 60)
+            bombs.push_back(random_position());
+
+        Game game = start_game(test.size_x, test.size_y, test.radius, 1);
+        std::set<Position> blocks;
+        std::vector<Event> events;
+        for (size_t n = 0; n < cells_count * test.blocks_percent / 100; n++) {
+            Position position = random_position();
+            blocks.insert(position);
+            events.push_back(BlockPlaced(position));
+        }
+        for (game_length_t turn = 0; turn <= bombs.size(); turn++) {
+            std::set<Position> expected;
+            if (turn > 0) {
+                Position bomb = bombs[turn - 1];
+                expected = reference_explosion(blocks, bomb, test.size_x, test.size_y, test.radius);
+                BombExploded::blocks_t destroyed;
+                for (Position position : expected) {
+                    if (blocks.erase(position))
+                        destroyed.push_back(position);
+                }
+                events.push_back(BombExploded((Bomb::id_t) turn - 1, {}, destroyed));
+                // Some blocks come back, so that the rays keep running into them.
+                for (size_t n = 0; n < destroyed.size() / 2; n++) {
+                    Position position = random_position();
+                    blocks.insert(position);
+                    events.push_back(BlockPlaced(position));
+                }
+            }
+            if (turn < bombs.size())
+                events.push_back(BombPlaced(turn, bombs[turn]));
+            game.process_turn(Turn(turn, std::move(events)));
+            events.clear();
+
+            Frame frame = draw(game);
+            if (cells(frame.explosions) != cells(expected) || cells(frame.blocks) != cells(blocks)) {
+                std::cerr << "test_explosions: board " << test.size_x << "x" << test.size_y << ", radius "
+                          << test.radius << ": wrong explosions in turn " << turn << "\n";
+                return false;
+            }
+            game.next_turn();
+        }
+    }
+    return true;
+}
+
+/* A board encodes exactly like the set of its cells: empty, with one cell at either
+ * end, around word boundaries, and sparse or dense across several summary words. */
+bool test_board_encoding() {
+    const std::vector<std::pair<Position::coord_t, Position::coord_t>> sizes = {
+        {1, 1}, {1, 64}, {3, 50}, {100, 100}, {300, 300}, {65535, 1},
+    };
+    for (auto [size_x, size_y] : sizes) {
+        size_t cells_count = (size_t) size_x * size_y;
+        auto cell_position = [&](size_t cell) {
+            return Position((Position::coord_t) (cell / size_y), (Position::coord_t) (cell % size_y));
+        };
+        std::mt19937 random(size_x);
+        std::vector<std::pair<std::string, std::vector<Position>>> cases = {
+            {"empty", {}},
+            {"first cell", {cell_position(0)}},
+            {"last cell", {cell_position(cells_count - 1)}},
+        };
+        std::vector<Position> boundaries;
+        for (size_t cell : {63, 64, 127, 128, 4095, 4096, 4097, 8191, 8192}) {
+            if (cell < cells_count)
+                boundaries.push_back(cell_position(cell));
+        }
+        cases.emplace_back("word boundaries", boundaries);
+        for (size_t per_cells : {4096, 64, 2}) {
+            std::vector<Position> positions;
+            for (size_t n = 0; n < cells_count / per_cells + 1; n++)
+                positions.push_back(cell_position(random() % cells_count));
+            cases.emplace_back("one in " + std::to_string(per_cells), positions);
+        }
+
+        for (const auto &[name, positions] : cases) {
+            Board board(size_x, size_y);
+            std::set<Position> set;
+            for (Position position : positions) {
+                board.insert(position);
+                set.insert(position);
+            }
+            // Cells taken out again clear their words, and summary bits with them.
+            for (size_t n = 0; n < positions.size() / 2; n++) {
+                board.erase(positions[n]);
+                set.erase(positions[n]);
+            }
+            // Cells are compared too, bytes claimed for cells a board fails to iterate keep old data.
+            if (cells(board) != cells(set) || encode(board) != encode(set)
+                || encoded_size(board) != encoded_size(set)) {
+                std::cerr << "test_board_encoding: board " << size_x << "x" << size_y << ", " << name
+                          << ": encoded differently from a set\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// A bomb still there when its timer runs out stops the game, as it did when timers were counted down.
+bool test_bomb_not_exploded() {
+    for (Bomb::timer_t bomb_timer : std::vector<Bomb::timer_t>{0, 1, 3}) {
+        Game game = start_game(10, 10, 2, bomb_timer);
+        game.process_turn(Turn(0, {BombPlaced(0, Position(1, 1))}));
+        for (game_length_t turn = 0; turn <= bomb_timer; turn++) {
+            if (turn > 0)
+                game.process_turn(Turn(turn, {}));
+            try {
+                game.next_turn();
+            } catch (std::runtime_error &error) {
+                if (turn == bomb_timer && std::string(error.what()) == "Bomb not exploded in time.")
+                    break;
+                std::cerr << "test_bomb_not_exploded: timer " << bomb_timer << ": \"" << error.what()
+                          << "\" thrown after turn " << turn << "\n";
+                return false;
+            }
+            if (turn == bomb_timer) {
+                std::cerr << "test_bomb_not_exploded: timer " << bomb_timer << ": nothing thrown\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* The timers drawn for the GUI count down from bomb_timer like they did when each bomb
+ * was decremented every turn, over several laps of the wheel of expiring bombs. Bombs
+ * explode when their timer runs out or earlier, and ids are sometimes placed again. */
+bool test_bomb_timers() {
+    for (Bomb::timer_t bomb_timer : std::vector<Bomb::timer_t>{1, 2, 7}) {
+        std::mt19937 random(bomb_timer);
+        Game game = start_game(10, 10, 2, bomb_timer);
+        std::map<Bomb::id_t, std::pair<Position, Bomb::timer_t>> bombs;
+        Bomb::id_t next_id = 0;
+        for (game_length_t turn = 0; turn < 10 * (bomb_timer + 1); turn++) {
+            std::vector<Event> events;
+            for (auto it = bombs.begin(); it != bombs.end();) {
+                if (it->second.second == 0 || random() % 4 == 0) {
+                    events.push_back(BombExploded(it->first, {}, {}));
+                    it = bombs.erase(it);
+                } else {
+                    it++;
+                }
+            }
+            for (size_t n = random() % 3; n > 0; n--) {
+                Bomb::id_t id = !bombs.empty() && random() % 4 == 0 ? bombs.begin()->first : next_id++;
+                Position position((Position::coord_t) (random() % 10), (Position::coord_t) (random() % 10));
+                events.push_back(BombPlaced(id, position));
+                bombs[id] = {position, bomb_timer};
+            }
+            game.process_turn(Turn(turn, std::move(events)));
+
+            std::vector<std::pair<Cells, Bomb::timer_t>> expected, drawn;
+            for (const auto &[id, bomb] : bombs)
+                expected.emplace_back(cells(std::vector{bomb.first}), bomb.second);
+            for (const auto &[position, timer] : draw(game).bombs)
+                drawn.emplace_back(cells(std::vector{position}), timer);
+            if (drawn != expected) {
+                std::cerr << "test_bomb_timers: timer " << bomb_timer << ": wrong bombs drawn in turn " << turn << "\n";
+                return false;
+            }
+
+            game.next_turn();
+            for (auto &[id, bomb] : bombs)
+                bomb.second--;
+        }
+    }
+    return true;
+}
+
+// Hands out bytes in chunks of random size, like a stream that delivers them bit by bit.
+class ChunkedInTransport : public InTransport {
+public:
+    ChunkedInTransport(unsigned seed) : random(seed) {}
+
+    void append(const std::string &more) { bytes += more; }
+
+    virtual size_t receive(void *dest, size_t n) {
+        if (offset == bytes.size())
+            throw std::runtime_error("End of stream.");
+        size_t length = std::min({n, bytes.size() - offset, (size_t) (random() % 300 + 1)});
+        memcpy(dest, bytes.data() + offset, length);
+        offset += length;
+        return length;
+    }
+
+    virtual size_t pending() { return offset < bytes.size(); }
+
+    virtual size_t get_memory_usage() { return sizeof(*this) + bytes.capacity(); }
+
+private:
+    std::mt19937 random;
+    std::string bytes;
+    size_t offset = 0;
+};
+
+/* Turns of a random game, as the server sends them: blocks and bombs placed, robots
+ * moving, and bombs going off on time, destroying robots and blocks around them. */
+std::vector<std::string> record_turns(unsigned seed, game_length_t turns, Bomb::timer_t bomb_timer) {
+    std::mt19937 random(seed);
+    auto random_position = [&random]() {
+        return Position((Position::coord_t) (random() % 30), (Position::coord_t) (random() % 30));
+    };
+    std::map<game_length_t, std::vector<Bomb::id_t>> exploding;
+    std::vector<Position> blocks;
+    Bomb::id_t next_bomb = 0;
+    std::vector<std::string> recorded;
+    for (game_length_t turn = 0; turn < turns; turn++) {
+        std::vector<Event> events;
+        for (Bomb::id_t id : exploding[turn]) {
+            BombExploded::robots_t robots;
+            for (Player::id_t player = 0; player < 2; player++) {
+                if (random() % 3 == 0)
+                    robots.push_back(player);
+            }
+            BombExploded::blocks_t destroyed;
+            for (size_t n = random() % 6; n > 0 && !blocks.empty(); n--) {
+                destroyed.push_back(blocks.back());
+                blocks.pop_back();
+            }
+            events.push_back(BombExploded(id, robots, destroyed));
+        }
+        exploding.erase(turn);
+        for (size_t n = random() % (turn == 0 ? 200 : 4); n > 0; n--) {
+            blocks.push_back(random_position());
+            events.push_back(BlockPlaced(blocks.back()));
+        }
+        for (size_t n = random() % 3; n > 0; n--) {
+            events.push_back(BombPlaced(next_bomb, random_position()));
+            exploding[(game_length_t) (turn + bomb_timer)].push_back(next_bomb++);
+        }
+        for (Player::id_t player = 0; player < 2; player++)
+            events.push_back(PlayerMoved(player, random_position()));
+        std::shuffle(events.begin() + (ptrdiff_t) exploding.count(turn), events.end(), random);
+        recorded.push_back(encode(ServerMessage(Turn(turn, std::move(events)))));
+    }
+    return recorded;
+}
+
+/* Turns applied as views straight from a TCP buffer, fed in random chunks, draw the
+ * same frames as owning turns. Non-blocking, each turn first arrives cut short. */
+bool test_turn_views() {
+    const game_length_t turns = 300;
+    const Bomb::timer_t bomb_timer = 4;
+    for (bool blocking : {true, false}) {
+        std::vector<std::string> recorded = record_turns(blocking, turns, bomb_timer);
+        std::mt19937 random(7);
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        ChunkedInTransport transport(blocking);
+        TCPInBuffer views(socket, transport);
+        views.set_blocking(blocking);
+        MemoryInBuffer owning;
+        Game game = start_game(30, 30, 3, bomb_timer);
+        Game game_from_views = start_game(30, 30, 3, bomb_timer);
+
+        for (game_length_t turn = 0; turn < turns; turn++) {
+            const std::string &bytes = recorded[turn];
+            ServerMessageView message_view;
+            if (blocking) {
+                transport.append(bytes);
+            } else {
+                size_t cut = random() % bytes.size();
+                transport.append(bytes.substr(0, cut));
+                views.read_pending();
+                DecodeError error = decode(views, message_view);
+                if (error != DecodeError::Incomplete) {
+                    std::cerr << "test_turn_views: turn " << turn << " cut after " << cut << " bytes: \""
+                              << describe(error) << "\"\n";
+                    return false;
+                }
+                views.rewind();
+                transport.append(bytes.substr(cut));
+                views.read_pending();
+            }
+            DecodeError error = decode(views, message_view);
+            if (error != DecodeError::None) {
+                std::cerr << "test_turn_views: turn " << turn << " not decoded: \"" << describe(error) << "\"\n";
+                return false;
+            }
+            game_from_views.process_turn(std::get<TurnView>(message_view));
+
+            ServerMessage message;
+            owning.assign(bytes.data(), bytes.size());
+            if (decode(owning, message) != DecodeError::None)
+                throw std::runtime_error("Turn not decoded.");
+            game.process_turn(std::move(std::get<Turn>(message)));
+
+            if (encode(game_from_views) != encode(game)) {
+                std::cerr << "test_turn_views: different frames in turn " << turn << "\n";
+                return false;
+            }
+            game.next_turn();
+            game_from_views.next_turn();
+        }
+    }
+    return true;
+}
+
+// Turns cut short or with corrupted lengths are rejected, without the buffer growing to fit them.
+bool test_malformed_turn_views() {
+    const std::string turn("\x03\x00\x05", 3);
+    const std::string bomb_exploded = std::string("\x01\x00\x00\x00\x09", 5);
+    const std::vector<std::tuple<std::string, std::string, DecodeError>> cases = {
+        {"cut short", turn + std::string("\x00\x00\x00\x02" "\x03\x00\x01", 7), DecodeError::NotEnoughData},
+        {"corrupted event count", turn + std::string("\xff\xff\xff\xff" "\x03\x00\x01\x00\x02", 9),
+         DecodeError::NotEnoughData},
+        {"corrupted robot count", turn + std::string("\x00\x00\x00\x01", 4) + bomb_exploded
+         + std::string("\x7f\xff\xff\xff\x00", 5), DecodeError::NotEnoughData},
+        {"corrupted block count", turn + std::string("\x00\x00\x00\x01", 4) + bomb_exploded
+         + std::string("\x00\x00\x00\x00" "\xff\xff\xff\xf0" "\x00\x01\x00\x02", 12), DecodeError::NotEnoughData},
+        {"unknown event", turn + std::string("\x00\x00\x00\x01" "\x04\x00\x01\x00\x02", 9),
+         DecodeError::UnknownType},
+    };
+    for (const auto &[name, bytes, expected] : cases) {
+        MemoryInBuffer memory(bytes);
+        ServerMessageView message_view;
+        DecodeError error = decode(memory, message_view);
+
+        boost::asio::io_context io_context;
+        tcp::socket socket(io_context);
+        ChunkedInTransport transport(0);
+        transport.append(bytes);
+        TCPInBuffer tcp(socket, transport);
+        tcp.set_blocking(false);
+        tcp.read_pending();
+        DecodeError tcp_error = decode(tcp, message_view);
+        DecodeError tcp_expected = expected == DecodeError::NotEnoughData ? DecodeError::Incomplete : expected;
+
+        if (error != expected || tcp_error != tcp_expected || tcp.get_memory_usage() > TCPInBuffer::MAX_READ_AHEAD) {
+            std::cerr << "test_malformed_turn_views: " << name << ": \"" << describe(error) << "\" and \""
+                      << describe(tcp_error) << "\" with " << tcp.get_memory_usage() << " bytes buffered\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    passed &= test_board_encoding();
+    passed &= test_explosions();
+    passed &= test_bomb_not_exploded();
+    passed &= test_bomb_timers();
+    passed &= test_turn_views();
+    passed &= test_malformed_turn_views();
+    return passed ? 0 : 1;
+}
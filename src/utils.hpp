@@ -7,8 +7,10 @@
 #include <list>
 #include <set>
 #include <map>
+#include <vector>
 #include <variant>
 #include <type_traits>
+#include <boost/container/small_vector.hpp>
 
 // helper type to use with std::visit
 template<class... Ts> struct visitors : Ts... { using Ts::operator()...; };
@@ -35,6 +37,28 @@ std::ostream &operator<<(std::ostream &stream, const std::list<T> &list) {
 }
 
 
+template <typename T>
+std::ostream &operator<<(std::ostream &stream, const std::vector<T> &vector) {
+    stream << "[ ";
+    for (const T &val : vector) {
+        stream << val << ", ";
+    }
+    stream << " ]";
+    return stream;
+}
+
+
+template <typename T, size_t N>
+std::ostream &operator<<(std::ostream &stream, const boost::container::small_vector<T, N> &vector) {
+    stream << "[ ";
+    for (const T &val : vector) {
+        stream << val << ", ";
+    }
+    stream << " ]";
+    return stream;
+}
+
+
 template <typename T>
 std::ostream &operator<<(std::ostream &stream, const std::set<T> &set) {
     stream << "[ ";
@@ -49,7 +73,7 @@ std::ostream &operator<<(std::ostream &stream, const std::set<T> &set) {
 template <typename U, typename V>
 std::ostream &operator<<(std::ostream &stream, const std::map<U, V> &map) {
     stream << "{ ";
-    for (const std::pair<U, V> &key_val : map) {
+    for (const std::pair<const U, V> &key_val : map) {
         stream << key_val << ", ";
     }
     stream << " }";